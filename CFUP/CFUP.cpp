@@ -1,21 +1,18 @@
 #include "CFUP.h"
 #include "CFUPManager.h"
-#include <QDateTime>
 #include <QThread>
+#include <QtEndian>
 #include "tools/tools.h"
 
 #define THREAD_CHECK(ret) if (!threadCheck_(__FUNCTION__))return ret
+#define SUBMIT(op, data, priority) if (QThread::currentThread() != thread()) {cm->submit_(serial, op, data, priority);return;} // 其他线程的调用转交给管理器所在线程, 需要访问this, 对象删除之后使用CFUPHandle
 
 CFUP::CFUP(CFUPManager *parent, const QHostAddress &IP, unsigned short p) : QObject(parent), IP(IP), port(p), cm(parent) {
-    connect(&hbt, &QTimer::timeout, this, [&]() {
-        if (cs == 1) {
-            auto *cdpt = newCDPT_();
-            cdpt->cf = 0x05;
-            cdpt->SID = ID + sendWnd.size() + sendBufLv1.size();
-            sendBufLv1.append(cdpt);
-            updateWnd_();
-        }
-    });
+    timeout = cm->config.timeout; // 本地参数, 握手期间就生效
+    retryNum = cm->config.retryNum;
+    maxInflate = cm->config.maxInflate;
+    serial = ++cm->serial;
+    cm->live[serial] = this;
 }
 
 bool CFUP::threadCheck_(const QString &funcName) {
@@ -26,6 +23,23 @@ bool CFUP::threadCheck_(const QString &funcName) {
     return false;
 }
 
+CFUPHandle CFUP::handle() {
+    THREAD_CHECK({});
+    return {cm, serial};
+}
+
+void CFUPHandle::send(const QByteArray &data, unsigned char priority) const {
+    if (cm != nullptr && serial != 0)cm->submit_(serial, SubmitQueue::SEND, data, priority); // 在管理器所在线程调用也经过队列, 保持与其他提交的顺序
+}
+
+void CFUPHandle::sendNow(const QByteArray &data) const {
+    if (cm != nullptr && serial != 0)cm->submit_(serial, SubmitQueue::SEND_NOW, data, 0);
+}
+
+void CFUPHandle::close(const QByteArray &data) const {
+    if (cm != nullptr && serial != 0)cm->submit_(serial, SubmitQueue::CLOSE, data, 0);
+}
+
 QHostAddress CFUP::getIP() {
     THREAD_CHECK(QHostAddress::Null);
     return IP;
@@ -46,180 +60,436 @@ void CFUP::proc_(const QByteArray &data) { // 该函数只能被CFUPManager调
     auto cmd = (unsigned char) (cf & (unsigned char) 0x07);
 
     if (NA && RT)return;
-    if (1 <= cmd && cmd <= 5 && !UDL) {
+    stats.packetsRecv++;
+    stats.bytesRecv += data.size();
+    if (cs == 1)active_(); // 收到对方的数据, 说明对方在线, 推迟心跳
+    bool command = 1 <= cmd && cmd <= 5 && !UDL;
+    if (cs != 1 && !command)return; // 握手完成之前不确定对方的SID长度, 丢弃, 由对方重发
+    if (cs == 1 && !cookie.isEmpty() && cmd != 3 && cmd != 4)cookie.clear(); // 无状态的对方只会回复RC ACK和C NA, 收到其他数据包说明已经创建了连接对象, 不再需要带回cookie
+    if (command) {
         if (cmd == 1)cmdRC_(data); // RC指令, 请求
         if (cmd == 2)cmdACK_(NA, data); // ACK指令, 应答
         if (cmd == 3)cmdRC_ACK_(RT, data); // RC ACK指令, 请求应答
         if (cmd == 4)cmdC_(NA, UD, data); // C指令, 断开
         if (cmd == 5)cmdH_(RT, data); // H命令, 心跳包
+    } else if (cmd == 6 && NA) { // 无需应答的EX扩展命令, 立即处理
+        if (UD && data.size() > 1)cmdEX_(data.mid(1));
     } else {
         if (!NA && UD) {//需要回复, 有用户数据
-            if (data.size() <= 11)return;
-            unsigned short SID = (*(unsigned short *) (data.data() + 1));
-            long long time = *(long long *) (data.data() + 3);
+            auto hdr = 1 + sidLen_() + 8;
+            if (data.size() <= hdr)return;
+            auto SID = readSID_(data.data() + 1);
+            long long time = *(long long *) (data.data() + 1 + sidLen_());
             if (!time_(SID, time))return;
             NA_ACK_(SID);
+            if (!inRecvWnd_(SID)) { // 已经交付过的重发包, 应答即可
+                if (SID != 0)recvLastTime.remove(SID);
+                if (((OID - SID) & sidMask_()) < agreed.wndSize)stats.duplicates++;
+                else stats.outOfWindow++;
+                return;
+            }
+            if (recvWnd.contains(SID) && recvWnd[SID].rebuilt) { // 已经由前向纠错恢复, 原包晚到
+                stats.duplicates++;
+                return;
+            }
             if (recvWnd.contains(SID) && !RT)close("窗口数据发生重叠"); // 如果窗口包含该数据而且不是重发包
-            else if (!RT || !recvWnd.contains(SID)) { //如果是重发包，并且接收窗口中已经有该数据，则不需要再次存储
+            else if (recvWnd.contains(SID))stats.duplicates++;
+            else { //如果是重发包，并且接收窗口中已经有该数据，则不需要再次存储
                 // 从数据包中提取用户数据，跳过前三个字节的头部信息
-                recvWnd[SID] = {cf, SID, data.mid(11)};
+                recvWnd[SID] = {cf, SID, data.mid(hdr)};
             }
         } else if (UD) {//有用户数据
             if (data.size() <= 1)return;
-            readBuf.append(data.mid(1));
-            emit readyRead();
+            deliver_(data, 1);
+            if (cs != 1)return; // 处理函数中断开了连接
         }
     }
     updateWnd_();
 }
 
-void CFUP::send(const QByteArray &data) {
-    THREAD_CHECK();
+void CFUP::send(const QByteArray &data, unsigned char priority) {
+    SUBMIT(SubmitQueue::SEND, data, priority);
     if (cs != 1 || data.isEmpty())return;
-    sendBufLv2.append(data);
-    QTimer::singleShot(0, [this]() { updateWnd_(); });
+    if (priority >= CFUP_PRIORITIES)priority = CFUP_PRIORITIES - 1;
+    sendBufLv2[priority].msgs.append({data, cm->clockUs_(), ++msgQueued});
+    postWnd_();
 }
 
 void CFUP::sendNow(const QByteArray &data) {
-    THREAD_CHECK();
+    SUBMIT(SubmitQueue::SEND_NOW, data, 0);
     if (cs != 1 || data.isEmpty())return;
-    auto *tmp = new CDPT(this);
-    tmp->data = data;
-    tmp->cf = 0x60;
-    sendPackage_(tmp);
-    delete tmp;
+    CDPT tmp;
+    tmp.data = data;
+    tmp.cf = 0x60;
+    sendPackage_(&tmp);
+}
+
+CFUPStats CFUP::getStats() {
+    THREAD_CHECK({});
+    auto tmp = stats;
+    tmp.sendWnd = sendWnd.size();
+    tmp.recvWnd = recvWnd.size();
+    tmp.sendBufLv1 = sendBufLv1.size();
+    tmp.sendBufLv2 = 0;
+    for (auto &i: sendBufLv2)tmp.sendBufLv2 += i.msgs.size();
+    tmp.readBuf = readBuf.size();
+    return tmp;
+}
+
+void CFUP::setFEC(bool enable, unsigned char k) {
+    THREAD_CHECK();
+    if (!enable)fecFlush_();
+    fec = enable;
+    fecSize = k;
+    if (fecSize == 1)fecSize = 2;
+    if (fecSize > 32)fecSize = 32;
+}
+
+CFUPConfig CFUP::getConfig() {
+    THREAD_CHECK({});
+    auto tmp = agreed;
+    tmp.wndSize = wndSize;
+    tmp.dataBlockSize = dataBlockSize;
+    tmp.hbtTime = hbtTime;
+    tmp.timeout = timeout;
+    tmp.retryNum = retryNum;
+    tmp.maxInflate = maxInflate;
+    return tmp;
+}
+
+void CFUP::setConfig(const CFUPConfig &config) {
+    THREAD_CHECK();
+    wndSize = qBound(1u, config.wndSize, agreed.wndSize); // 只能缩小发送窗口, 接收窗口保持协商结果
+    dataBlockSize = qBound((unsigned short) 16, config.dataBlockSize, agreed.dataBlockSize);
+    hbtTime = qMax(config.hbtTime, (unsigned short) 100);
+    timeout = qMax(config.timeout, (unsigned short) 10);
+    retryNum = config.retryNum;
+    maxInflate = config.maxInflate;
+    if (pmtuBase != 0) { // 新的数据块大小作为路径MTU探测的上限, 重新探测
+        pmtuMax = qBound((unsigned short) 16, config.dataBlockSize, qMin(agreed.dataBlockSize, pmtuCeiling_()));
+        pmtuBase = qMin(pmtuBase, pmtuMax);
+        pmtuLo = qMin(pmtuLo, pmtuMax);
+        dataBlockSize = pmtuLo;
+        probeSize = 0;
+        pmtuConfirm = false;
+        pmtuTime = 0;
+    }
+    if (cs == 1)hbtJitter_();
+    postWnd_();
 }
 
-void CFUP::connectToHost_() { // 该函数只能被CFUPManager调用
+void CFUP::connectToHost_(const QByteArray &ticket) { // 该函数只能被CFUPManager调用
     if (cs != -1)return;
     initiative = true;
     auto cdpt = newCDPT_();
     cdpt->SID = 0;
     cdpt->cf = (char) 0x01;
+    cdpt->data = cm->hello_(); // 握手提议
+    if (!ticket.isEmpty() && !earlyData.isEmpty())cdpt->data += dumpTLV(TLV_TICKET, ticket) + dumpTLV(TLV_EARLY_DATA, earlyData); // 0-RTT, 数据随RC一起发送
+    if (!cdpt->data.isEmpty())cdpt->cf = (char) 0x41;
     sendBufLv1.append(cdpt); // 直接放入一级缓存
+    nextSID = 1;
     cs = 0; // 半连接
     updateWnd_();
 }
 
 void CFUP::close(const QByteArray &data) {
-    THREAD_CHECK();
+    SUBMIT(SubmitQueue::CLOSE, data, 0);
     if (cs != 2) {
-        auto cdpt = new CDPT(this);
-        cdpt->cf = 0x24;
+        CDPT cdpt;
+        cdpt.cf = 0x24;
         if (!data.isEmpty()) {
-            cdpt->cf |= 0x40;
-            cdpt->data = data;
+            cdpt.cf |= 0x40;
+            cdpt.data = data;
         }
-        sendPackage_(cdpt);
-        delete cdpt;
+        sendPackage_(&cdpt);
         cs = 2;
     }
-    for (auto i: sendWnd)i->deleteLater();
-    for (auto i: sendBufLv1)i->deleteLater();
+    for (auto i: sendWnd)delete i; // 定时器由CFUPManager按照SID查找, 删除之后到期时自动忽略
+    for (auto i: sendBufLv1)delete i;
     sendWnd.clear();
     sendBufLv1.clear();
-    sendBufLv2.clear();
-    hbt.stop();
+    for (auto &i: sendBufLv2)i = SendQueue();
+    sending = -1;
+    failWaiters_();
     emit disconnected(data);
 }
 
 void CFUP::updateWnd_() {
     // 更新发送窗口
     while (sendWnd.contains(ID)) { // 释放掉已经接收停止的数据包
-        if (sendWnd[ID]->isActive())break; // 如果数据包还未被接收, break
-        delete sendWnd[ID]; // 释放内存
+        auto cdpt = sendWnd[ID];
+        if (cdpt->isActive())break; // 如果数据包还未被接收, break
+        if (cdpt->msgTime != 0) { // 消息的所有分片都已经被应答
+            auto latency = cm->clockUs_() - cdpt->msgTime;
+            stats.messagesSent++;
+            stats.latency.record(latency);
+            cm->stats.latency.record(latency);
+        }
+        if (cdpt->msgSeq != 0 && awaited.remove(cdpt->msgSeq))acked_(cdpt->msgSeq);
+        delete cdpt; // 释放内存
         sendWnd.remove(ID); // 移除
-        ID++; // ID++
+        ID = (ID + 1) & sidMask_(); // ID++
     }
-    updateSendBuf_(); // 更新发送缓存
-    while ((sendWnd.size() < wndSize) && (!sendBufLv1.isEmpty())) { // 循环添加一级缓存的数据包
-        auto cdpt = sendBufLv1.front(); // 取首元素
-        sendBufLv1.pop_front();
+    bool drained = false; // 没有更多要发送的数据, 而不是窗口已满
+    while (sendWnd.size() < wndSize) { // 循环添加数据包, 命令包优先, 然后按照优先级分片
+        CDPT *cdpt;
+        if (!sendBufLv1.isEmpty())cdpt = sendBufLv1.takeFirst();
+        else if ((cdpt = fragment_()) == nullptr) {
+            drained = true;
+            break;
+        }
         sendWnd[cdpt->SID] = cdpt; // 放到发送窗口
+        cdpt->sendTime = cm->clockUs_();
         sendPackage_(cdpt); // 发送数据包
-        cdpt->start(timeout); // 启动定时器
+        arm_(cdpt); // 启动定时器
+        if (cs == 1)active_(); // 正在发送可靠数据, 推迟心跳
+        fecLoss_(false);
+        if (fec)fecAdd_(cdpt);
     }
-    while (recvWnd.contains(OID + 1)) { // 如果接收到了数据
-        OID++; // OID++
-        recvBuf.append(recvWnd[OID].data); // 先添加进来数据
-        if (!((recvWnd[OID].cf >> 7) & 0x01)) { // 如果不是链表包
-            readBuf.append(recvBuf); // 添加到可读缓存
-            recvBuf.clear(); // 清空接收缓存
+    if (drained && fecState != nullptr && fecState->count >= 2)fecFlush_(); // 一次突发结束, 尾部的分组不再等待后续数据包
+    while (recvWnd.contains((OID + 1) & sidMask_())) { // 如果接收到了数据
+        OID = (OID + 1) & sidMask_(); // OID++
+        if (OID != 0)recvLastTime.remove(OID); // 已经交付, 之后的重发由接收窗口判断
+        auto cmd = (unsigned char) (recvWnd[OID].cf & 0x07);
+        if ((cmd != 0 && cmd != 7) || !((recvWnd[OID].cf >> 6) & 0x01)) { // 命令包(心跳包, EX扩展命令)只占用ID, 不参与重组
+            auto pkg = recvWnd.take(OID);
+            if (cmd == 6 && !pkg.data.isEmpty())cmdEX_(pkg.data); // EX扩展命令按照SID顺序处理
+            if (cs != 1)return; // 处理过程中连接断开
+            continue;
+        }
+        auto pkg = recvWnd.take(OID); // 取出当前数据包
+        auto buf = &recvBuf;
+        if (cmd == 7) { // 交错发送的消息, 第一个字节是通道号, 每个通道分别重组
+            auto channel = pkg.data.isEmpty() ? CFUP_PRIORITIES : (unsigned char) pkg.data[0];
+            if (channel >= CFUP_PRIORITIES) {
+                close("通道号不正确");
+                return;
+            }
+            buf = &recvChannel[channel];
+            buf->append(pkg.data.constData() + 1, pkg.data.size() - 1);
+        } else buf->append(pkg.data); // 先添加进来数据
+        if (!((pkg.cf >> 7) & 0x01)) { // 如果不是链表包
+            if (!decode_(*buf)) {
+                close("消息解压失败");
+                return;
+            }
+            stats.messagesRecv++;
+            deliver_(*buf); // 交给处理函数或者添加到可读缓存
+            buf->clear(); // 清空接收缓存
+            if (cs != 1)return; // 处理函数中断开了连接
+        }
+        if (fecSeen) { // 保留最近64个数据包, 校验包可能覆盖已经交付的SID
+            auto &hist = fec_()->hist;
+            hist[OID] = pkg;
+            hist.remove((OID - 64) & sidMask_());
         }
-        recvWnd.remove(OID); // 移除当前数据包
     }
-    if (!readBuf.isEmpty())emit readyRead();
 }
 
-void CFUP::sendPackage_(CDPT *cdpt) { // 只负责构造数据包和发送
+void CFUP::sendPackage_(CDPT *cdpt, bool fragment) { // 只负责构造数据包头部和发送, 用户数据由传输层直接引用
     QByteArray data;
-    data.append((char) cdpt->cf);
+    if (initiative && CID != 0) { // 携带连接ID
+        data.append((char) (cdpt->cf | 0x08));
+        data += dump(CID);
+    } else data.append((char) cdpt->cf);
     unsigned char cmd = (char) (cdpt->cf & (char) 0x07);
     bool NA = (cdpt->cf >> 5) & 0x01;
+    bool wide = sid32 && cmd != 1 && cmd != 3; // 握手数据包始终使用16位SID
     if (!NA) {
-        data += dump(cdpt->SID);
-        data += dump(QDateTime::currentMSecsSinceEpoch()); // 发送时间
+        data += wide ? dump(cdpt->SID) : dump((unsigned short) cdpt->SID);
+        data += dump(cm->wallMs_()); // 发送时间
     }
-    if ((cmd == 2) || (cmd == 3))data += dump(cdpt->AID);
-    if ((cdpt->cf >> 6) & 0x01)data += cdpt->data;
-    cm->send_(IP, port, data);
-}
-
-void CFUP::updateSendBuf_() { // 更新发送缓存
-    // 从二级缓存解包到一级缓存
-    if (!sendBufLv1.isEmpty() || sendBufLv2.isEmpty())return;
-    auto data = sendBufLv2.front(); // 拿一个数据
-    sendBufLv2.pop_front();
-    // 全部序列化到一级缓存
-    if (data.size() <= dataBlockSize) { // 数据包长度小于块大小
-        auto cdpt = newCDPT_();
-        cdpt->data = data;
-        cdpt->cf = 0x40;
-        cdpt->SID = ID + sendWnd.size();
-        sendBufLv1.append(cdpt);
-    } else { // 否则进行拆包
-        QByteArrayList dataBlock; // 数据块
-        QByteArray i = data, tmp;
-        while (!i.isEmpty()) { // 迭代
-            unsigned short dbs = dataBlockSize;
-            if (i.size() <= dataBlockSize)dbs = i.size(); // 计算实际数据块大小
-            tmp.append(i, dbs); // 赋值tmp
-            dataBlock.append(tmp); // 添加到数据块
-            tmp.clear(); // 清空tmp
-            i = i.mid(dbs); // 迭代
-        }
-        auto baseID = sendWnd.size(); // 获取当前窗口长度
-        for (qsizetype j = 0; j < dataBlock.size(); j++) {
-            auto cdpt = newCDPT_();
-            cdpt->data = dataBlock[j];
-            cdpt->SID = ID + j + baseID;
-            if (j != dataBlock.size() - 1)cdpt->cf = 0xC0; // 链表包
-            else cdpt->cf = 0x40; // 非链表包
-            sendBufLv1.append(cdpt);
+    if ((cmd == 2) || (cmd == 3))data += wide ? dump(cdpt->AID) : dump((unsigned short) cdpt->AID);
+    bool UD = (cdpt->cf >> 6) & 0x01;
+    stats.packetsSent++;
+    stats.bytesSent += data.size() + (UD ? cdpt->data.size() : 0);
+    cm->send_(IP, port, data, UD ? cdpt->data : QByteArray(), fragment);
+}
+
+CDPT *CFUP::fragment_() { // 严格优先级, 低优先级被抢先太多次之后插入一个分片(老化)
+    if (cs != 1)return nullptr; // 连接成功之前不分配SID
+    int p = sending; // 不能交错发送时, 必须先发完正在分片的消息
+    if (p == -1) {
+        for (int i = 0; i < CFUP_PRIORITIES; i++) {
+            auto &q = sendBufLv2[i];
+            if (q.msg.isEmpty() && q.msgs.isEmpty())continue;
+            if (p == -1)p = i;
+            else if (q.starve >= 32) {
+                p = i;
+                break;
+            }
         }
+        if (p == -1)return nullptr;
+    }
+    for (int i = p + 1; i < CFUP_PRIORITIES; i++) {
+        auto &q = sendBufLv2[i];
+        if (!q.msg.isEmpty() || !q.msgs.isEmpty())q.starve++;
+    }
+    auto &q = sendBufLv2[p];
+    q.starve = 0;
+    if (q.msg.isEmpty()) { // 取下一条消息
+        auto msg = q.msgs.takeFirst();
+        q.msg = msg.encoded ? msg.data : encode_(msg.data); // 在分片之前压缩, 广播的消息已经统一压缩过
+        q.offset = 0;
+        q.time = msg.time;
+        q.seq = msg.seq;
+    }
+    bool channel = agreed.interleave && p != PRIORITY_NORMAL; // 交错发送时, 普通优先级以外的消息使用cmd 7, 第一个字节是通道号
+    auto cdpt = newCDPT_();
+    auto len = qMin((qsizetype) dataBlockSize - (channel ? 1 : 0), q.msg.size() - q.offset); // 按照当前数据块大小分片, 路径MTU变化时下一个分片立即生效
+    if (channel) { // 通道号在分片数据前面, 只能复制
+        cdpt->data.append((char) p);
+        cdpt->data.append(q.msg.constData() + q.offset, len);
+    } else if (len == q.msg.size())cdpt->data = q.msg; // 不需要分片, 直接共享
+    else { // 分片直接引用消息, 不复制, 由owner保持消息存活
+        cdpt->owner = q.msg;
+        cdpt->data = QByteArray::fromRawData(q.msg.constData() + q.offset, len);
+    }
+    q.offset += len;
+    cdpt->SID = nextSID_();
+    cdpt->cf = channel ? 0x47 : 0x40;
+    if (q.offset < q.msg.size()) { // 链表包
+        cdpt->cf |= 0x80;
+        if (!agreed.interleave)sending = p;
+    } else { // 非链表包, 消息分片完成
+        cdpt->msgTime = q.time;
+        cdpt->msgSeq = q.seq;
+        q.msg.clear();
+        sending = -1;
+    }
+    return cdpt;
+}
+
+void CFUP::postWnd_() {
+    if (wndPending)return;
+    wndPending = true;
+    cm->post_(this);
+}
+
+unsigned int CFUP::nextSID_() {
+    auto SID = nextSID;
+    nextSID = (nextSID + 1) & sidMask_();
+    return SID;
+}
+
+void CFUP::active_() {
+    activeTime = cm->clock_();
+}
+
+void CFUP::heartbeat_(long long now) { // 只有空闲超过本轮心跳间隔才发送心跳包
+    if (cs != 1)return;
+    if (now - activeTime >= 1000)trim_(); // 空闲超过1秒, 上一次心跳也已经应答
+    if (now - activeTime < hbtDelay)return;
+    hbtJitter_();
+    auto *cdpt = newCDPT_();
+    cdpt->cf = 0x05;
+    cdpt->SID = nextSID_();
+    sendBufLv1.append(cdpt);
+    updateWnd_();
+}
+
+void CFUP::trim_() {
+    if (sendWnd.isEmpty())sendWnd = {}; // QHash删除元素不会释放桶, 赋值为空才会释放
+    if (recvWnd.isEmpty())recvWnd = {};
+    if (recvLastTime.isEmpty())recvLastTime = {};
+    if (sendBufLv1.isEmpty())sendBufLv1 = {}; // QList清空之后保留容量
+    if (readBuf.isEmpty())readBuf = {};
+    for (auto &i: sendBufLv2)if (i.msgs.isEmpty())i.msgs = {};
+    if (fecState != nullptr) { // 空闲之后历史不会再被校验包引用, 剩下的单个数据包校验没有意义
+        fecFlush_();
+        delete fecState;
+        fecState = nullptr;
+    }
+    if (path != nullptr && cm->clock_() - path->time >= timeout) { // 验证请求已经超时
+        delete path;
+        path = nullptr;
+    }
+}
+
+void CFUP::hbtJitter_() { // 心跳时间±10%的抖动, 避免大量连接同时心跳
+    hbtDelay = hbtTime - hbtTime / 10 + cm->random_() % (hbtTime / 5 + 1);
+}
+
+void CFUP::sendEX_(unsigned char type, const QByteArray &data) {
+    auto cdpt = newCDPT_();
+    cdpt->cf = 0x46; // UD EX
+    cdpt->SID = nextSID_();
+    cdpt->data.append((char) type);
+    cdpt->data += data;
+    sendBufLv1.append(cdpt);
+}
+
+void CFUP::path_(const QHostAddress &newIP, unsigned short newPort, const QByteArray &data) { // 该函数只能被CFUPManager调用
+    bool isPath = path != nullptr && newIP == path->IP && newPort == path->port;
+    if (isPath && (unsigned char) data[0] == 0x66 && data.size() == 10 && data[1] == (char) EX_PATH_RESPONSE && data.mid(2) == path->token) {
+        delete path; // 验证通过, 迁移到新地址, 窗口和缓存全部保留
+        path = nullptr;
+        if (cm->migrate_(this, newIP, newPort))emit addressChanged();
+        return;
     }
+    auto now = cm->clock_();
+    if (!isPath || now - path->time >= timeout) { // 向新地址发送路径验证请求
+        if (path == nullptr)path = new PathState;
+        path->IP = newIP;
+        path->port = newPort;
+        path->time = now;
+        path->token = dump(cm->random_()) + dump(cm->random_());
+        QByteArray tmp;
+        tmp.append((char) 0x66); // NA UD EX
+        tmp.append((char) EX_PATH_CHALLENGE);
+        tmp += path->token;
+        cm->send_(newIP, newPort, tmp);
+    }
+    proc_(data); // 数据照常处理, 验证通过之前回复仍然发往旧地址
+}
+
+bool CFUP::inRecvWnd_(unsigned int SID) { // SID在(OID, OID + 窗口大小]之间才是新数据
+    return ((SID - OID - 1) & sidMask_()) < agreed.wndSize;
+}
+
+unsigned int CFUP::sidMask_() {
+    return sid32 ? 0xFFFFFFFF : 0xFFFF;
+}
+
+int CFUP::sidLen_() {
+    return sid32 ? 4 : 2;
+}
+
+QByteArray CFUP::dumpSID_(unsigned int SID) {
+    return sid32 ? dump(SID) : dump((unsigned short) SID);
+}
+
+unsigned int CFUP::readSID_(const char *data) {
+    return sid32 ? *(unsigned int *) data : *(unsigned short *) data;
 }
 
 CDPT *CFUP::newCDPT_() {
-    auto *cdpt = new CDPT(this);
-    connect(cdpt, &CDPT::timeout, this, &CFUP::sendTimeout_);
-    return cdpt;
+    return new CDPT;
+}
+
+void CFUP::arm_(CDPT *cdpt) {
+    cdpt->due = cm->clock_() + timeout;
+    cm->addTimer_(serial, cdpt->SID, cdpt->due);
 }
 
-void CFUP::sendTimeout_() { // 只做重发包逻辑和重试次数过多逻辑
-    auto cdpt = (CDPT *) sender();
+void CFUP::sendTimeout_(CDPT *cdpt) { // 只做重发包逻辑和重试次数过多逻辑, 由CFUPManager在定时器到期时调用
     if (cdpt->retryNum < retryNum) {
         cdpt->retryNum++;
         cdpt->cf |= 0x10;
-        sendPackage_(cdpt);
+        stats.retransmits++;
+        fecLoss_(true);
+        pmtuLoss_(cdpt);
+        if (!cookie.isEmpty())handshakeACK_(); // 还没有收到过可靠数据包的应答, 带回cookie的NA ACK可能丢失, 先重发
+        sendPackage_(cdpt, pmtuBase != 0 && cdpt->data.size() > dataBlockSize); // 路径MTU可能变小, 已经分配SID的大数据包不能重新分片, 允许IP分片重发
+        arm_(cdpt); // 重新计时
     } else close("对方应答超时");
 }
 
 QByteArray CFUP::nextPendingData() {
     THREAD_CHECK({});
-    auto tmp = readBuf.front();
-    readBuf.pop_front();
-    return tmp;
+    if (readBuf.isEmpty())return {};
+    return readBuf.takeFirst();
 }
 
 bool CFUP::hasData() {
@@ -229,30 +499,128 @@ bool CFUP::hasData() {
 
 QByteArrayList CFUP::readAll() {
     THREAD_CHECK({});
-    auto tmp = readBuf;
-    readBuf.clear();
-    return tmp;
+    return std::exchange(readBuf, {});
+}
+
+std::span<const QByteArray> CFUP::peekAll() {
+    THREAD_CHECK({});
+    return {readBuf.constData(), (size_t) readBuf.size()};
+}
+
+void CFUP::consume(qsizetype n) {
+    THREAD_CHECK();
+    if (n >= readBuf.size())readBuf.clear();
+    else if (n > 0)readBuf.remove(0, n); // 从头部删除只移动起始位置, 不搬移剩余的消息
+}
+
+void CFUP::setReadHandler(const std::function<void(QByteArrayView)> &handler) {
+    THREAD_CHECK();
+    readHandler = handler;
+}
+
+void CFUP::deliver_(const QByteArray &data, qsizetype offset) {
+    if (readHandler && recvWaiters.isEmpty()) { // 直接交给处理函数, 不复制; 有协程在等待时先交给协程
+        readHandler(QByteArrayView(data).sliced(offset));
+        return;
+    }
+    readBuf.append(offset == 0 ? data : data.sliced(offset));
+    readyRead_();
+}
+
+void CFUP::NA_ACK_(unsigned int AID) {
+    CDPT cdpt;
+    cdpt.AID = AID;
+    cdpt.cf = (char) 0x22;
+    sendPackage_(&cdpt);
+}
+
+void CFUP::handshakeACK_() { // 应答RC ACK始终使用16位AID, 对方可能还没有切换SID长度
+    auto wide = sid32;
+    sid32 = false;
+    if (cookie.isEmpty())NA_ACK_(0);
+    else {
+        CDPT cdpt; // 无状态握手, 需要带回cookie
+        cdpt.AID = 0;
+        cdpt.cf = (char) 0x62;
+        cdpt.data = dumpTLV(TLV_COOKIE, cookie) + cm->hello_(); // 对方没有保存状态, 重复握手提议
+        sendPackage_(&cdpt);
+    }
+    sid32 = wide;
+}
+
+void CFUP::accept_() { // 该函数只能被CFUPManager调用
+    ID = 1;
+    nextSID = 1;
+    OID = 0;
+    cs = 1;
+    sid32 = agreed.SID32; // 握手完成, 切换SID长度
+    cm->cfupConnected_(this);
+    if (cs != 1)return;
+    hbtJitter_();
+    active_();
+    updateWnd_(); // 发送会话票据
 }
 
-void CFUP::NA_ACK_(unsigned short AID) {
-    auto cdpt = new CDPT(this);
-    cdpt->AID = AID;
-    cdpt->cf = (char) 0x22;
-    sendPackage_(cdpt);
-    delete cdpt;
+void CFUP::apply_(const QHash<unsigned char, QByteArray> &tlv) {
+    compress = tlv.contains(TLV_COMPRESS);
+    agreed = CFUPConfig(); // 没有PARAMS表示双方都使用默认参数
+    if (tlv.contains(TLV_PARAMS))cm->parseParams_(tlv.value(TLV_PARAMS), agreed);
+    wndSize = agreed.wndSize;
+    dataBlockSize = agreed.dataBlockSize;
+    hbtTime = agreed.hbtTime;
 }
 
-bool CFUP::time_(unsigned short SID, long long time) {
-    if (recvLastTime.contains(SID)) {
-        if (recvLastTime[0] >= time)return false;
-        return true;
+QByteArray CFUP::encode_(const QByteArray &data) { // 标识(1) + 数据, 0x00原始数据, 0x01 zlib
+    if (!compress)return data;
+    QByteArray tmp(1, (char) 0x00);
+    if (data.size() < 64 || compressSkip > 0) { // 太小或者最近的数据不可压缩
+        if (compressSkip > 0)compressSkip--;
+        return tmp + data;
     }
+    if (data.size() > 4096 && qCompress(data.left(4096), 1).size() > 4096 * 9 / 10) { // 大数据先采样前4K, 压缩率太低就不压缩整个消息
+        compressSkip = 16;
+        return tmp + data;
+    }
+    auto z = qCompress(data, 1);
+    if (z.size() >= data.size()) { // 压缩之后反而变大
+        compressSkip = 16;
+        return tmp + data;
+    }
+    tmp[0] = (char) 0x01;
+    return tmp + z;
+}
+
+bool CFUP::decode_(QByteArray &data) {
+    if (!compress)return true;
+    if (data.isEmpty())return false;
+    auto flag = data[0];
+    if (flag == 0x00)data.remove(0, 1);
+    else if (flag == 0x01) {
+        if (data.size() < 5 || qFromBigEndian<quint32>(data.constData() + 1) > maxInflate)return false; // qUncompress按照声明的大小分配内存, 不能信任
+        data = qUncompress(data.mid(1));
+        if (data.isEmpty())return false;
+    } else return false;
+    return true;
+}
+
+bool CFUP::time_(unsigned int SID, long long time) {
+    if (recvLastTime.contains(SID))return recvLastTime.value(0, 0) < time; // 查找SID 0不插入
     recvLastTime[SID] = time;
     return true;
 }
 
-CFUP::~CFUP() = default;
+CFUP::~CFUP() {
+    for (auto i: sendWnd)delete i;
+    for (auto i: sendBufLv1)delete i;
+    delete fecState;
+    delete path;
+    if (cm != nullptr)cm->live.remove(serial); // 管理器先析构时cm为nullptr
+}
 
-CDPT::CDPT(QObject *parent) : QTimer(parent) {}
+bool CDPT::isActive() const {
+    return due != 0;
+}
 
-CDPT::~CDPT() = default;
+void CDPT::stop() {
+    due = 0;
+}
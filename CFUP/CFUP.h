@@ -1,12 +1,70 @@
 #pragma once
 
-#include <QTimer>
+#include <QObject>
 #include <QHash>
+#include <QSet>
 #include <QHostAddress>
+#include <functional>
+#include <span>
+#include "CFUPStats.h"
+#include "CFUPAwait.h"
 
 class CFUPManager;
 class CDPT;
 
+enum CFUPTLV : unsigned char { // 握手扩展字段类型
+    TLV_COOKIE = 0x01, // 无状态握手cookie
+    TLV_TICKET = 0x02, // 0-RTT会话票据
+    TLV_EARLY_DATA = 0x03, // 0-RTT数据
+    TLV_EARLY_ACCEPTED = 0x04, // 0-RTT数据已被接收
+    TLV_COMPRESS = 0x05, // 消息压缩
+    TLV_PARAMS = 0x06, // 连接参数
+};
+
+enum CFUPEX : unsigned char { // EX扩展命令类型
+    EX_TICKET = 0x01, // 下发会话票据
+    EX_CID = 0x02, // 下发连接ID
+    EX_PATH_CHALLENGE = 0x03, // 路径验证请求
+    EX_PATH_RESPONSE = 0x04, // 路径验证应答
+    EX_FEC = 0x05, // 前向纠错异或校验
+    EX_PROBE = 0x06, // 路径MTU探测
+    EX_PROBE_ACK = 0x07, // 路径MTU探测应答
+};
+
+enum CFUPPriority : unsigned char { // 消息优先级, 数值越小越优先
+    PRIORITY_HIGH = 0, // 控制消息
+    PRIORITY_NORMAL = 1, // 默认
+    PRIORITY_LOW = 2, // 批量传输
+};
+
+const unsigned char CFUP_PRIORITIES = 3; // 优先级数量, 也是交错发送的通道数量
+
+class CFUPConfig { // 连接参数
+public:
+    unsigned int wndSize = 64; // 窗口大小, 16位SID最大32767, 32位SID最大1048576, 握手协商取双方较小值
+    unsigned short dataBlockSize = 1005; // 可靠传输时数据块大小, 最大65516, 握手协商取双方较小值
+    unsigned short hbtTime = 15000; // 心跳时间, 握手协商取双方较小值
+    unsigned short timeout = 1000; // 超时时间, 只在本地生效
+    unsigned char retryNum = 2; // 重试次数, 只在本地生效
+    unsigned int maxInflate = 16777216; // 压缩消息解压之后的最大大小, 对方声明的大小超过它时断开连接, 只在本地生效
+    bool SID32 = false; // 32位SID, 双方都开启才会生效
+    bool interleave = false; // 不同优先级的消息按分片交错发送, 双方都开启才会生效, 否则只在消息之间按优先级调度
+};
+
+//其他线程使用的连接句柄, 只保存管理器和序号, 提交时不访问CFUP对象, 连接删除之后的提交被丢弃
+//管理器需要比所有使用句柄的线程活得更久, 删除管理器之前先停止这些线程
+class CFUPHandle {
+public:
+    CFUPManager *cm = nullptr;
+    unsigned long long serial = 0; // CFUP在管理器中的序号, 0表示无效
+
+    void send(const QByteArray &, unsigned char = PRIORITY_NORMAL) const; // 任意线程调用
+
+    void sendNow(const QByteArray &) const; // 任意线程调用
+
+    void close(const QByteArray & = {}) const; // 任意线程调用
+};
+
 //CFUP协议对象类(实现)
 class CFUP final : public QObject {
 Q_OBJECT
@@ -16,11 +74,21 @@ public:
 
     unsigned short getPort();
 
-    void close(const QByteArray & = {});
+    CFUPHandle handle(); // 获取交给其他线程使用的句柄
+
+    void close(const QByteArray & = {}); // 其他线程调用时CFUP对象必须还没有删除, 否则使用handle
+
+    void send(const QByteArray &, unsigned char = PRIORITY_NORMAL); // 其他线程的调用经过管理器的无锁队列批量转交, CFUP对象必须还没有删除, 否则使用handle
+
+    void sendNow(const QByteArray &); // 同send
+
+    void setFEC(bool, unsigned char = 0); // 开启前向纠错, 每组数据包数量(2~32), 0表示根据丢包率自适应
 
-    void send(const QByteArray &);
+    CFUPStats getStats(); // 获取统计快照
 
-    void sendNow(const QByteArray &);
+    CFUPConfig getConfig(); // 获取当前连接参数
+
+    void setConfig(const CFUPConfig &); // 设置当前连接参数, 窗口大小和数据块大小不能超过握手协商的结果, 不能修改SID长度
 
     QByteArray nextPendingData();
 
@@ -28,51 +96,136 @@ public:
 
     QByteArrayList readAll();
 
+    std::span<const QByteArray> peekAll(); // 查看所有可读消息, 不复制, 在consume或者回到事件循环之前有效
+
+    void consume(qsizetype); // 移除前n条可读消息, 与peekAll配合批量读取
+
+    void setReadHandler(const std::function<void(QByteArrayView)> &); // 消息交付时直接调用, 不进入可读缓存, 不触发readyRead, 视图只在调用期间有效, 传入空函数恢复; 有asyncRecv在等待时消息先交给协程
+
+    CFUPRecvAwaiter asyncRecv(); // co_await得到下一条消息, 连接断开时为空, 只能在管理器所在线程调用
+
+    CFUPSendAwaiter asyncSend(const QByteArray &, unsigned char = PRIORITY_NORMAL); // 发送消息, co_await在消息被完整应答后恢复, 结果为false表示连接已经断开或者在其他线程调用
+
 public slots:
 
 signals:
 
     void disconnected(const QByteArray & = {});
 
-    void readyRead();
-
-private slots:
+    void readyRead(); // 有新的可读消息, 每一批数据包最多触发一次, 没有新消息时不会因为缓存里还有消息而再次触发
 
-    void sendTimeout_();
+    void addressChanged(); // 对方地址发生变化(连接迁移)
 
 private:
     class CFUPDP {//纯数据
     public:
         unsigned char cf = 0;//属性和命令
-        unsigned short SID = 0;//本包ID
+        unsigned int SID = 0;//本包ID
         QByteArray data{};//用户数据
+        bool rebuilt = false;//由前向纠错恢复
+    };
+
+    class FecState { // 前向纠错的分组和历史, 开启前向纠错或者收到对方的校验包时才分配, 空闲时释放
+    public:
+        unsigned char k = 0; // 当前分组的数据包数量
+        unsigned char count = 0; // 当前分组已经累计的数据包数量
+        unsigned int first = 0; // 当前分组第一个SID
+        unsigned short len = 0; // 当前分组数据长度的异或
+        unsigned char cf = 0; // 当前分组cf的异或
+        QByteArray parity; // 当前分组数据的异或
+        QHash<unsigned int, CFUPDP> hist; // 最近交付的数据包, 用于恢复跨越OID的分组
+    };
+
+    class PathState { // 正在进行的路径验证, 对方地址变化时才分配, 验证通过后释放
+    public:
+        QHostAddress IP; // 正在验证的新地址
+        unsigned short port = 0; // 正在验证的新端口
+        QByteArray token; // 路径验证令牌
+        long long time = 0; // 上次发送路径验证请求的时间
+    };
+
+    class SendQueue { // 一个优先级的发送2级缓存
+    public:
+        class Msg {
+        public:
+            QByteArray data;
+            long long time = 0; // send时间(微秒)
+            unsigned long long seq = 0; // 消息序号
+            bool encoded = false; // 已经压缩过(广播), 分片之前不需要再压缩
+        };
+
+        QList<Msg> msgs; // 等待分片的消息
+        QByteArray msg; // 正在分片的消息(已压缩)
+        qsizetype offset = 0; // 正在分片的消息已经分片的长度
+        long long time = 0; // 正在分片的消息的send时间(微秒)
+        unsigned long long seq = 0; // 正在分片的消息序号
+        unsigned int starve = 0; // 有数据但是被更高优先级抢先的次数, 用于老化
     };
 
     CFUPManager *cm = nullptr; // CFUPManager
+    unsigned long long serial = 0; // 在CFUPManager中的序号, 定时器和延迟的窗口更新按序号查找, 不会误用已经删除的对象
     char cs = -1; // -1未连接, 0半连接, 1连接成功, 2已断开
-    unsigned short ID = 0; // 自己的包ID
-    unsigned short OID = -1; // 对方当前包ID
+    unsigned int ID = 0; // 自己的包ID
+    unsigned int OID = 0xFFFF; // 对方当前包ID
 
-    QHash<unsigned short, long long> recvLastTime; // 接收窗口历史接收到的最大的时间
-    QHash<unsigned short, CDPT *> sendWnd; // 发送窗口
-    QHash<unsigned short, CFUPDP> recvWnd; // 接收窗口
-    QList<CDPT *> sendBufLv1; // 发送1级缓存
+    QHash<unsigned int, long long> recvLastTime; // 接收窗口内的SID首次收到时的发送时间, 交付之后删除(SID 0除外)
+    QHash<unsigned int, CDPT *> sendWnd; // 发送窗口
+    QHash<unsigned int, CFUPDP> recvWnd; // 接收窗口
+    QList<CDPT *> sendBufLv1; // 发送1级缓存, 只有已经分配SID的命令包(心跳, EX扩展命令, 握手), 优先进入发送窗口
     QByteArrayList readBuf; // 可读缓存
-    QByteArrayList sendBufLv2; // 发送2级缓存
+    std::function<void(QByteArrayView)> readHandler; // 消息处理函数, 设置之后消息不进入可读缓存
+    bool readPending = false; // 已经请求CFUPManager在本轮结束时触发readyRead
+    SendQueue sendBufLv2[CFUP_PRIORITIES]; // 发送2级缓存, 每个优先级一个
+    int sending = -1; // 不能交错发送时, 正在分片的消息的优先级, -1表示没有
     QByteArray recvBuf; // 接收缓存
-    // 外部发送 -> 发送2级缓存 -> 发送1级缓存 -> 发送窗口 -> 发送
+    QByteArray recvChannel[CFUP_PRIORITIES]; // 交错发送的消息每个通道的接收缓存
+    unsigned int nextSID = 0; // 下一个分配的SID
+    bool wndPending = false; // 已经请求CFUPManager延迟更新窗口
+    unsigned long long msgQueued = 0; // 已经进入发送2级缓存的消息数量, 也是最后分配的消息序号
+    QSet<unsigned long long> awaited; // asyncSend发送的还没有被完整应答的消息序号
+    QList<CFUPRecvAwaiter *> recvWaiters; // 等待消息的协程
+    QList<CFUPSendAwaiter *> sendWaiters; // 等待消息应答的协程
+    // 外部发送 -> 发送2级缓存(按优先级) -> 分片(进入窗口时才分配SID) -> 发送窗口 -> 发送
+    // 命令包 -> 发送1级缓存 -> 发送窗口 -> 发送
     // 接收 -> 接收窗口 -> 接收缓存 -> 可读缓存 -> 准备好读取
     // NA数据包不需要走发送缓存和发送窗口, 直接发送
 
-    unsigned short wndSize = 64; // 窗口大小, 最大65533
-    unsigned short dataBlockSize = 1005; // 可靠传输时数据块大小, 生产环境默认1005, 最大65516
-    QTimer hbt; // 心跳包定时器
+    unsigned int wndSize = 64; // 发送窗口大小, 不超过握手协商的窗口大小
+    unsigned short dataBlockSize = 1005; // 可靠传输时数据块大小, 不超过握手协商的数据块大小
     unsigned short hbtTime = 15000; // 心跳时间
+    CFUPConfig agreed; // 握手协商结果, 接收窗口按照协商的窗口大小判断
+    bool sid32 = false; // 当前使用32位SID, 握手完成之后才切换, 握手数据包始终使用16位SID
+    unsigned short hbtDelay = 0; // 本轮心跳间隔(心跳时间加随机抖动)
+    long long activeTime = 0; // 最后活跃时间, 有数据往来时刷新, 空闲超过hbtDelay才发送心跳
     QHostAddress IP; // 远程主机IP
     unsigned short port; // 远程主机port
     bool initiative = false; // 主动性
+    QByteArray cookie; // 对方无状态握手时下发的cookie, 应答RC ACK时需要原样带回, 对方创建连接对象之前保留
+    QByteArray earlyData; // 主动连接时的0-RTT数据, 对方没有接收时连接成功后重新发送
+    bool early = false; // 对方的0-RTT票据验证通过
+    unsigned int CID = 0; // 连接ID, 由被动方分配, 主动方发送的数据包需要携带, 0表示没有
+    PathState *path = nullptr; // 路径验证
+    bool fec = false; // 是否开启前向纠错
+    unsigned char fecSize = 0; // 前向纠错每组数据包数量, 0表示根据丢包率自适应
+    FecState *fecState = nullptr; // 前向纠错的分组和历史
+    double lossRate = 0; // 丢包率估计, 超时重发的比例
+    bool fecSeen = false; // 对方开启了前向纠错, 需要保留最近交付的数据包
+    bool compress = false; // 已协商消息压缩, 每条消息前面带1字节压缩标识
+    unsigned char compressSkip = 0; // 采样发现数据不可压缩, 直接跳过接下来的消息
+    unsigned short pmtuBase = 0; // 路径MTU探测的起点, 认为一定可用的数据块大小, 0表示没有开启探测
+    unsigned short pmtuLo = 0; // 已确认可用的最大数据块大小
+    unsigned short pmtuHi = 0; // 当前探测上限
+    unsigned short pmtuMax = 0; // 数据块大小上限, 本地链路MTU和握手协商结果中较小的一个
+    unsigned short probeSize = 0; // 正在探测的数据块大小, 0表示没有正在进行的探测
+    unsigned char probeCount = 0; // 当前大小已经发送的探测次数
+    long long probeTime = 0; // 上次发送探测包的时间
+    long long pmtuTime = 0; // 上次完成探测的时间
+    unsigned int pmtuRaise = 600000; // 完成探测之后, 隔一段时间重新探测更大的数据块
+    bool pmtuConfirm = false; // 大数据包超时, 正在确认当前数据块大小是否仍然可用(黑洞检测)
     unsigned short timeout = 1000; // 超时时间
     unsigned char retryNum = 2; // 重试次数
+    unsigned int maxInflate = 16777216; // 压缩消息解压之后的最大大小
+    CFUPStats stats; // 统计计数, 窗口和缓存占用在获取快照时填写
 
     explicit CFUP(CFUPManager *, const QHostAddress &, unsigned short);
 
@@ -82,17 +235,87 @@ private:
 
     void proc_(const QByteArray &); // 处理来者信息
 
-    void connectToHost_(); // 连接到主机
+    void connectToHost_(const QByteArray & = {}); // 连接到主机, 有票据时0-RTT数据随RC一起发送
 
     void updateWnd_(); // 更新窗口
 
-    void updateSendBuf_(); // 更新发送缓存
+    CDPT *fragment_(); // 按照优先级从发送2级缓存取下一个分片, 没有返回nullptr
+
+    void postWnd_(); // 延迟更新窗口, 同一轮事件循环里多次调用只更新一次
+
+    unsigned int nextSID_(); // 分配一个SID
+
+    void deliver_(const QByteArray &, qsizetype = 0); // 交付一条消息: 数据, 开始位置
+
+    void readyRead_(); // 有新的可读消息, 先交给等待的协程, 剩余的请求CFUPManager触发readyRead
 
-    void sendPackage_(CDPT *); // 返回值是NA
+    void notifyRead_(); // 由CFUPManager在本轮结束时调用, 触发readyRead
+
+    void acked_(unsigned long long); // asyncSend发送的消息被完整应答
+
+    void failWaiters_(); // 连接断开, 恢复所有等待的协程
+
+    void active_(); // 刷新活跃时间
+
+    void heartbeat_(long long); // 心跳检查, 由CFUPManager统一扫描调用
+
+    void trim_(); // 空闲时释放空容器和不再需要的状态, 下次使用时重新分配
+
+    void hbtJitter_(); // 重新生成本轮心跳间隔
+
+    bool inRecvWnd_(unsigned int); // SID是否在接收窗口内
+
+    unsigned int sidMask_(); // SID取值掩码
+
+    int sidLen_(); // SID字节数
+
+    QByteArray dumpSID_(unsigned int);
+
+    unsigned int readSID_(const char *);
+
+    FecState *fec_(); // 前向纠错状态, 没有时分配
+
+    void fecAdd_(CDPT *); // 把首次发送的数据包加入当前分组
+
+    void fecFlush_(); // 发送当前分组的校验包
+
+    void fecRecv_(const QByteArray &); // 收到校验包, 尝试恢复丢失的数据包
+
+    void fecLoss_(bool); // 更新丢包率估计
+
+    void pmtuStart_(); // 开启路径MTU探测
+
+    unsigned short pmtuCeiling_(); // 本地链路MTU对应的最大数据块大小
+
+    void pmtud_(long long); // 路径MTU探测检查, 由CFUPManager统一扫描调用
+
+    void pmtuNext_(); // 二分查找下一个探测大小
+
+    void pmtuLoss_(CDPT *); // 数据包超时, 检查是否是路径MTU变小
+
+    void probe_(unsigned short); // 发送填充到指定数据块大小的探测包
+
+    void probeACK_(unsigned short); // 收到探测应答
+
+    void sendPackage_(CDPT *, bool = false); // 发送数据包, 第二个参数为true时允许IP分片
 
     CDPT *newCDPT_(); // new一个CDPT
 
-    void NA_ACK_(unsigned short);
+    void arm_(CDPT *); // 启动重发定时器
+
+    void sendTimeout_(CDPT *); // 重发定时器到期
+
+    void NA_ACK_(unsigned int);
+
+    void handshakeACK_(); // 应答RC ACK
+
+    void accept_(); // 无状态握手cookie验证通过, 直接进入连接状态
+
+    void apply_(const QHash<unsigned char, QByteArray> &); // 应用握手协商结果
+
+    QByteArray encode_(const QByteArray &); // 压缩消息, 分片之前调用
+
+    bool decode_(QByteArray &); // 解压消息, 重组之后调用
 
     void cmdRC_(const QByteArray &);
 
@@ -104,23 +327,38 @@ private:
 
     void cmdH_(bool, const QByteArray &);
 
-    bool time_(unsigned short, long long);
+    void cmdEX_(const QByteArray &);
+
+    void sendEX_(unsigned char, const QByteArray &); // 可靠发送EX扩展命令, 调用方负责更新窗口
+
+    void path_(const QHostAddress &, unsigned short, const QByteArray &); // 处理从新地址收到的数据包(连接迁移)
+
+    bool time_(unsigned int, long long);
 
     friend class CFUPManager;
 
     friend class CDPT;
-};
 
-//CFUP数据包+定时器(定义)
-class CDPT : public QTimer, public CFUP::CFUPDP {
-Q_OBJECT
+    friend class CFUPRecvAwaiter;
+
+    friend class CFUPSendAwaiter;
+};
 
+//CFUP数据包+定时器(定义), 定时器由CFUPManager统一管理
+class CDPT : public CFUP::CFUPDP {
 private:
-    explicit CDPT(QObject *);
+    bool isActive() const; // 定时器是否在运行, 即数据包还没有被应答
 
-    ~CDPT() override;
+    void stop(); // 停止定时器
 
+    long long due = 0;//重发定时器到期时间, 0表示已经停止
     unsigned char retryNum = 0;//重发次数
-    unsigned short AID = 0;//应答包ID
+    unsigned int AID = 0;//应答包ID
+    long long sendTime = 0;//首次发送的时间(微秒)
+    long long msgTime = 0;//消息的send时间(微秒), 只有消息的最后一个分片有
+    unsigned long long msgSeq = 0;//消息序号, 只有消息的最后一个分片有
+    QByteArray owner;//data引用的消息, 分片不复制数据, 广播时所有连接共享同一份
     friend class CFUP;
+
+    friend class CFUPManager;
 };
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <QByteArray>
+#include <QHostAddress>
+
+class CFUP;
+class CFUPManager;
+
+//协程任务: 立即开始执行, 结束时自动销毁, 用于在协程中co_await CFUP的异步操作
+//协程由CFUPManager在本轮事件处理结束时恢复, 与信号一样运行在管理器所在线程
+class CFUPTask {
+public:
+    class promise_type {
+    public:
+        CFUPTask get_return_object() { return {}; }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+//co_await CFUPManager::asyncConnect, 结果是连接成功的CFUP, 连接失败为nullptr
+class CFUPConnectAwaiter {
+public:
+    bool await_ready();
+
+    bool await_suspend(std::coroutine_handle<>);
+
+    CFUP *await_resume();
+
+private:
+    CFUPConnectAwaiter(CFUPManager *, const QHostAddress &, unsigned short, const QByteArray &);
+
+    CFUPManager *cm;
+    QHostAddress IP;
+    unsigned short port;
+    QByteArray data; // 连接成功后发送的第一条数据
+    CFUP *result = nullptr;
+    std::coroutine_handle<> handle;
+
+    friend class CFUPManager;
+};
+
+//co_await CFUP::asyncRecv, 结果是下一条消息, 连接断开为空
+class CFUPRecvAwaiter {
+public:
+    bool await_ready();
+
+    void await_suspend(std::coroutine_handle<>);
+
+    QByteArray await_resume();
+
+private:
+    explicit CFUPRecvAwaiter(CFUP *);
+
+    CFUP *c;
+    QByteArray result;
+    std::coroutine_handle<> handle;
+
+    friend class CFUP;
+};
+
+//co_await CFUP::asyncSend, 消息的所有分片都被应答后恢复, 结果为false表示连接已经断开
+class CFUPSendAwaiter {
+public:
+    bool await_ready();
+
+    void await_suspend(std::coroutine_handle<>);
+
+    bool await_resume();
+
+private:
+    CFUPSendAwaiter(CFUP *, unsigned long long);
+
+    CFUP *c;
+    unsigned long long seq; // 消息序号, 0表示没有发送
+    bool result = false;
+    std::coroutine_handle<> handle;
+
+    friend class CFUP;
+};
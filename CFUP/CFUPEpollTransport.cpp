@@ -0,0 +1,301 @@
+#include "CFUPEpollTransport.h"
+#include "tools/tools.h"
+#include <QCoreApplication>
+#include <QEvent>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+static const int BATCH = 64; // recvmmsg和sendmmsg每次最多处理的数据包数量
+static const int SLOT = 65536; // 每个接收槽位的大小, 足够放下最大的UDP数据包
+static const int ROUNDS = 4; // 每个套接字每轮最多接收的批次, 避免一个套接字饿死定时器和另一个套接字
+
+CFUPEpollTransport::CFUPEpollTransport() {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epfd == -1)return;
+    for (auto fd: {tfd, efd}) {
+        if (fd == -1)continue;
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+CFUPEpollTransport::~CFUPEpollTransport() {
+    close();
+    if (tfd != -1)::close(tfd);
+    if (efd != -1)::close(efd);
+    if (epfd != -1)::close(epfd);
+}
+
+QString CFUPEpollTransport::bind(const QHostAddress &ip, unsigned short port) {
+    auto protocol = ip.protocol();
+    int *fdTmp = nullptr;
+    if (protocol == QAbstractSocket::IPv4Protocol)fdTmp = &fd4;
+    else if (protocol == QAbstractSocket::IPv6Protocol)fdTmp = &fd6;
+    if (fdTmp == nullptr)return "IP不正确";
+    if (*fdTmp != -1)return "CFUP管理器已绑定";
+    if (epfd == -1 || tfd == -1)return "epoll创建失败";
+    sockaddr_storage addr{};
+    socklen_t len;
+    int fd;
+    if (protocol == QAbstractSocket::IPv4Protocol) {
+        auto sin = (sockaddr_in *) &addr;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        sin->sin_addr.s_addr = htonl(ip.toIPv4Address());
+        len = sizeof(sockaddr_in);
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    } else {
+        auto sin6 = (sockaddr_in6 *) &addr;
+        auto ip6 = ip.toIPv6Address();
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        memcpy(&sin6->sin6_addr, &ip6, sizeof(ip6));
+        len = sizeof(sockaddr_in6);
+        fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int v6only = 1; // 与QUdpSocket绑定"::"的行为一致, IPv4由单独的套接字处理
+        if (fd != -1)setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+    }
+    if (fd == -1)return QString::fromLocal8Bit(strerror(errno));
+    if (::bind(fd, (sockaddr *) &addr, len) != 0) {
+        auto error = QString::fromLocal8Bit(strerror(errno));
+        ::close(fd);
+        return error;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    *fdTmp = fd;
+    dontFragment_(fd);
+    return {};
+}
+
+int CFUPEpollTransport::isBind() {
+    int tmp = 0;
+    if (fd4 != -1)tmp |= 1;
+    if (fd6 != -1)tmp |= 2;
+    return tmp;
+}
+
+void CFUPEpollTransport::send(const QHostAddress &IP, unsigned short port, const QByteArray &head, const QByteArray &body) {
+    auto protocol = IP.protocol();
+    auto fd = fd_(protocol);
+    if (fd == -1)return;
+    QByteArray addr;
+    if (protocol == QAbstractSocket::IPv4Protocol) {
+        sockaddr_in sin{};
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(port);
+        sin.sin_addr.s_addr = htonl(IP.toIPv4Address());
+        addr = QByteArray((const char *) &sin, sizeof(sin));
+    } else {
+        sockaddr_in6 sin6{};
+        auto ip6 = IP.toIPv6Address();
+        sin6.sin6_family = AF_INET6;
+        sin6.sin6_port = htons(port);
+        memcpy(&sin6.sin6_addr, &ip6, sizeof(ip6));
+        addr = QByteArray((const char *) &sin6, sizeof(sin6));
+    }
+    if (!dispatching) { // 不在事件处理中(例如应用直接调用sendNow), 立即发送
+        iovec iov[2] = {{(void *) head.constData(), (size_t) head.size()}, {(void *) body.constData(), (size_t) body.size()}};
+        msghdr msg{};
+        msg.msg_name = (void *) addr.constData();
+        msg.msg_namelen = (socklen_t) addr.size();
+        msg.msg_iov = iov;
+        msg.msg_iovlen = body.isEmpty() ? 1 : 2;
+        sendmsg(fd, &msg, 0);
+        return;
+    }
+    outbox.append({fd, addr, head, body});
+    if (outbox.size() >= BATCH)flush_();
+}
+
+void CFUPEpollTransport::sendFragmentable(const QHostAddress &IP, unsigned short port, const QByteArray &head, const QByteArray &body) {
+    auto fd = fd_(IP.protocol());
+    if (!df || fd == -1) {
+        send(IP, port, head, body);
+        return;
+    }
+    flush_(); // 已经排队的数据包仍然按照DF发送
+    dontFragment_(fd, true);
+    auto saved = dispatching;
+    dispatching = false; // 立即发送, 发送之后恢复DF
+    send(IP, port, head, body);
+    dispatching = saved;
+    dontFragment_(fd);
+}
+
+void CFUPEpollTransport::wake(long long time) {
+    if (tfd == -1 || (wakeAt != 0 && wakeAt <= time))return; // 已经有更早的唤醒
+    wakeAt = time;
+    auto delay = time - steadyUs() / 1000;
+    itimerspec spec{};
+    if (delay <= 0)spec.it_value.tv_nsec = 1; // 全0会停止timerfd
+    else {
+        spec.it_value.tv_sec = (time_t) (delay / 1000);
+        spec.it_value.tv_nsec = (long) (delay % 1000 * 1000000);
+    }
+    timerfd_settime(tfd, 0, &spec, nullptr);
+}
+
+void CFUPEpollTransport::notify() {
+    unsigned long long one = 1;
+    if (efd != -1)write(efd, &one, sizeof(one));
+}
+
+void CFUPEpollTransport::setDontFragment(bool enable) {
+    df = enable;
+    if (fd4 != -1)dontFragment_(fd4);
+    if (fd6 != -1)dontFragment_(fd6);
+}
+
+QHostAddress CFUPEpollTransport::localAddress(QAbstractSocket::NetworkLayerProtocol protocol) {
+    auto fd = fd_(protocol);
+    if (fd == -1)return {};
+    sockaddr_storage addr{};
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (sockaddr *) &addr, &len) != 0)return {};
+    return QHostAddress((const sockaddr *) &addr);
+}
+
+unsigned short CFUPEpollTransport::localPort(QAbstractSocket::NetworkLayerProtocol protocol) {
+    auto fd = fd_(protocol);
+    if (fd == -1)return 0;
+    sockaddr_storage addr{};
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (sockaddr *) &addr, &len) != 0)return 0;
+    if (addr.ss_family == AF_INET)return ntohs(((sockaddr_in *) &addr)->sin_port);
+    return ntohs(((sockaddr_in6 *) &addr)->sin6_port);
+}
+
+void CFUPEpollTransport::close() {
+    flush_();
+    for (auto fd: {&fd4, &fd6}) {
+        if (*fd == -1)continue;
+        if (epfd != -1)epoll_ctl(epfd, EPOLL_CTL_DEL, *fd, nullptr);
+        ::close(*fd);
+        *fd = -1;
+    }
+}
+
+int CFUPEpollTransport::run() {
+    if (epfd == -1 || tfd == -1)return -1;
+    running = true;
+    while (running)runOnce(-1);
+    return 0;
+}
+
+void CFUPEpollTransport::runOnce(int timeout) {
+    epoll_event events[8];
+    auto n = epoll_wait(epfd, events, 8, timeout);
+    dispatching = true;
+    bool polled = false;
+    for (int i = 0; i < n; i++) {
+        auto fd = events[i].data.fd;
+        unsigned long long counter;
+        if (fd == tfd) { // 唤醒时间到达
+            while (read(tfd, &counter, sizeof(counter)) > 0);
+            wakeAt = 0;
+        } else if (fd == efd) { // 其他线程提交了数据
+            while (read(efd, &counter, sizeof(counter)) > 0);
+        } else recv_(fd);
+        polled = true;
+    }
+    if (polled)poll_(); // 定时器和这一批数据包产生的延迟窗口更新
+    dispatching = false;
+    flush_();
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete); // 没有Qt事件循环, 在这里删除deleteLater的对象
+}
+
+void CFUPEpollTransport::stop() {
+    running = false;
+    notify(); // 其他线程调用时, 让正在等待的epoll_wait返回
+}
+
+int CFUPEpollTransport::fd() {
+    return epfd;
+}
+
+int CFUPEpollTransport::fd_(QAbstractSocket::NetworkLayerProtocol protocol) {
+    if (protocol == QAbstractSocket::IPv4Protocol)return fd4;
+    if (protocol == QAbstractSocket::IPv6Protocol)return fd6;
+    return -1;
+}
+
+void CFUPEpollTransport::dontFragment_(int fd, bool fragment) { // 同CFUPQtTransport
+    bool on = df && !fragment;
+    int v4 = on ? IP_PMTUDISC_PROBE : (fragment ? IP_PMTUDISC_DONT : IP_PMTUDISC_WANT);
+    int v6 = on ? IPV6_PMTUDISC_PROBE : (fragment ? IPV6_PMTUDISC_DONT : IPV6_PMTUDISC_WANT);
+    if (fd == fd6)setsockopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &v6, sizeof(v6));
+    else setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &v4, sizeof(v4));
+}
+
+void CFUPEpollTransport::recv_(int fd) {
+    if (recvBuf.isEmpty())recvBuf.resize(BATCH * SLOT); // 第一次接收时才分配
+    mmsghdr msgs[BATCH];
+    iovec iov[BATCH];
+    sockaddr_storage addrs[BATCH];
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < BATCH; i++) {
+            iov[i].iov_base = recvBuf.data() + (qsizetype) i * SLOT;
+            iov[i].iov_len = SLOT;
+            memset(&msgs[i], 0, sizeof(mmsghdr));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        }
+        auto n = recvmmsg(fd, msgs, BATCH, MSG_DONTWAIT, nullptr);
+        if (n <= 0)return;
+        for (int i = 0; i < n; i++) {
+            auto addr = (const sockaddr *) &addrs[i];
+            unsigned short port = addr->sa_family == AF_INET ? ntohs(((const sockaddr_in *) addr)->sin_port) : ntohs(((const sockaddr_in6 *) addr)->sin6_port);
+            deliver_(QHostAddress(addr), port, QByteArray((const char *) iov[i].iov_base, (qsizetype) msgs[i].msg_len));
+            if (fd != fd4 && fd != fd6)return; // 处理过程中套接字被关闭
+        }
+        if (n < BATCH)return; // 已经没有数据
+    }
+}
+
+void CFUPEpollTransport::flush_() {
+    qsizetype begin = 0;
+    while (begin < outbox.size()) { // 连续发往同一个套接字的数据包一起发送
+        auto fd = outbox[begin].fd;
+        mmsghdr msgs[BATCH];
+        iovec iov[BATCH][2]; // 头部和用户数据分开, 由内核聚集
+        int n = 0;
+        while (n < BATCH && begin + n < outbox.size() && outbox[begin + n].fd == fd) {
+            const auto &d = outbox[begin + n];
+            iov[n][0] = {(void *) d.head.constData(), (size_t) d.head.size()};
+            iov[n][1] = {(void *) d.body.constData(), (size_t) d.body.size()};
+            memset(&msgs[n], 0, sizeof(mmsghdr));
+            msgs[n].msg_hdr.msg_iov = iov[n];
+            msgs[n].msg_hdr.msg_iovlen = d.body.isEmpty() ? 1 : 2;
+            msgs[n].msg_hdr.msg_name = (void *) d.addr.constData();
+            msgs[n].msg_hdr.msg_namelen = (socklen_t) d.addr.size();
+            n++;
+        }
+        int sent = 0;
+        while (sent < n) {
+            auto r = sendmmsg(fd, msgs + sent, n - sent, 0);
+            if (r <= 0) {
+                if (r < 0 && errno == EINTR)continue;
+                sent++; // 跳过发送失败的数据包(例如EMSGSIZE), 与QUdpSocket一样丢弃
+                continue;
+            }
+            sent += r;
+        }
+        begin += n;
+    }
+    outbox.clear();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "CFUPTransport.h"
+#include <QList>
+#include <atomic>
+
+//基于epoll和timerfd的传输层(仅Linux), 不需要Qt事件循环, 由run在当前线程驱动; 仍然依赖QtCore和QtNetwork, deleteLater由runOnce处理
+//一次epoll_wait返回后用recvmmsg批量接收, 处理过程中产生的数据包在本轮结束时用sendmmsg批量发送
+class CFUPEpollTransport final : public CFUPTransport {
+public:
+    CFUPEpollTransport();
+
+    ~CFUPEpollTransport() override;
+
+    QString bind(const QHostAddress &, unsigned short) override;
+
+    int isBind() override;
+
+    void send(const QHostAddress &, unsigned short, const QByteArray &, const QByteArray & = {}) override;
+
+    void sendFragmentable(const QHostAddress &, unsigned short, const QByteArray &, const QByteArray & = {}) override;
+
+    void wake(long long) override;
+
+    void notify() override;
+
+    void setDontFragment(bool) override;
+
+    QHostAddress localAddress(QAbstractSocket::NetworkLayerProtocol) override;
+
+    unsigned short localPort(QAbstractSocket::NetworkLayerProtocol) override;
+
+    void close() override;
+
+    int run(); // 运行事件循环, 直到调用stop, epoll创建失败返回-1
+
+    void runOnce(int); // 处理一轮事件, 最多等待指定毫秒, -1表示一直等待
+
+    void stop(); // 让run在本轮结束后返回, 可以在回调中或者其他线程调用
+
+    int fd(); // epoll描述符, 嵌入其他事件循环时监听它可读, 然后调用runOnce(0)
+
+private:
+    class Datagram { // 待发送的数据包
+    public:
+        int fd = -1;
+        QByteArray addr; // sockaddr_in或sockaddr_in6
+        QByteArray head; // 头部
+        QByteArray body; // 用户数据, 引用CFUP的分片, 不复制
+    };
+
+    int epfd = -1; // epoll
+    int tfd = -1; // timerfd, 单调时钟
+    int efd = -1; // eventfd, 其他线程唤醒
+    int fd4 = -1; // IPv4套接字
+    int fd6 = -1; // IPv6套接字
+    bool df = false; // DF
+    std::atomic<bool> running = false;
+    bool dispatching = false; // 正在处理事件, 发送的数据包先放入outbox
+    long long wakeAt = 0; // timerfd当前的唤醒时间, 0表示没有
+    QList<Datagram> outbox; // 本轮待发送的数据包
+    QByteArray recvBuf; // recvmmsg的接收缓冲, 每个槽位64K
+
+    int fd_(QAbstractSocket::NetworkLayerProtocol); // 按照IP协议选择套接字
+
+    void dontFragment_(int, bool = false); // 按照df设置套接字, 第二个参数为true时临时允许分片
+
+    void recv_(int); // 批量接收, 直到没有数据或者达到本轮上限
+
+    void flush_(); // 批量发送outbox
+};
@@ -2,13 +2,28 @@
 #include "tools/tools.h"
 #include "CFUP.h"
 #include <QDateTime>
-#include <QUdpSocket>
-#include <QNetworkDatagram>
 #include <QThread>
+#include <QRandomGenerator>
+#include <QMessageAuthenticationCode>
+#include <QMetaMethod>
+#include "PcapWriter.h"
+#include "CFUPQtTransport.h"
 
 #define THREAD_CHECK(ret) if (!threadCheck_(__FUNCTION__))return ret
 
 void CFUPManager::proc_(const QHostAddress &IP, unsigned short port, const QByteArray &data) { // 来源于recv_调用, 不会被别的线程调用, 是私有函数
+    char cf = data[0];
+    if ((cf >> 3) & 0x01) { // 带有连接ID, 按连接ID查找, 不关心来源地址
+        if (data.size() < 5)return;
+        auto c = cids.value(*(unsigned int *) (data.data() + 1), nullptr);
+        if (c == nullptr)return;
+        QByteArray tmp;
+        tmp.append((char) (cf & ~0x08)); // 去掉连接ID之后交给cfup处理
+        tmp += data.mid(5);
+        if (c->IP == IP && c->port == port)c->proc_(tmp);
+        else c->path_(IP, port, tmp); // 来源地址变化, 需要路径验证
+        return;
+    }
     auto ipPort = IPPort(IP, port); // 转字符串
     if (ipPort.isEmpty())return; // 转换失败
     if (cfup.contains(ipPort) || connecting.contains(ipPort)) { // 如果已经存在对象
@@ -16,21 +31,68 @@ void CFUPManager::proc_(const QHostAddress &IP, unsigned short port, const QByte
         if (connecting.contains(ipPort))connecting[ipPort]->proc_(data);
         return;
     }
-    if (data.size() != 11)return; // 长度不正确
-    char cf = data[0];
-    if (cf != 0x11 && cf != 0x01)return; // 如果不是连接请求, 直接丢弃
+    if (stateless) {
+        if (cf == 0x62) { // 带cookie的NA ACK
+            cookieACK_(IP, port, data);
+            return;
+        }
+        if (!((cf >> 5) & 0x01) && (cf & 0x07) != 1) { // 对方认为已连接, 但是握手没有完成(cookie应答丢失), 让对方重发带回cookie的NA ACK
+            if (admit_(IP))send_(IP, port, QByteArray(1, (char) 0x24)); // 只回复1字节的C NA, 与RC共用准入限制, 避免被用于反射
+            return;
+        }
+    }
+    if (data.size() < 11)return; // 长度不正确
+    if ((cf & 0xAF) != 0x01)return; // 如果不是连接请求, 直接丢弃, 只允许RT和UD
+    bool UD = (cf >> 6) & 0x01;
+    if (!UD && data.size() != 11)return; // 没有握手扩展字段时长度必须是11
     unsigned short SID = (*(unsigned short *) (data.data() + 1)); // 提取SID
     if (SID != 0)return; // SID必须是0
-    if (cfup.size() >= connectNum)return; // 连接上限
+    if (!admit_(IP))return; // 来源请求过于频繁
+    if (cfup.size() >= connectNum) { // 连接上限
+        admission.fullRejected++;
+        return;
+    }
+    admission.admitted++;
+    QHash<unsigned char, QByteArray> tlv;
+    if (UD && !parseTLV(data.mid(11), tlv))return;
+    bool early = tlv.contains(TLV_TICKET) && checkTicket_(tlv[TLV_TICKET]); // 0-RTT
+    if (stateless && !early) { // 不分配任何资源, 由对方重发RC保证可靠
+        cookieRC_ACK_(IP, port, negotiate_(tlv));
+        return;
+    }
     auto tmp = new CFUP(this, IP, port);
+    tmp->early = early;
     connecting[ipPort] = tmp;
     connect(tmp, &CFUP::disconnected, this, &CFUPManager::requestInvalid_);
     tmp->proc_(data);
 }
 
-CFUPManager::CFUPManager(QObject *parent) : QObject(parent) {}
+CFUPManager::CFUPManager(QObject *parent) : QObject(parent) {
+    transport = new CFUPQtTransport(this); // 作为子对象, 随管理器一起moveToThread
+    ownTransport = true;
+    init_();
+}
 
-CFUPManager::~CFUPManager() = default; // 不允许被外部调用
+CFUPManager::CFUPManager(CFUPTransport *t, QObject *parent) : QObject(parent) {
+    transport = t;
+    init_();
+}
+
+void CFUPManager::init_() {
+    transport->cm = this;
+    sweepDue = clock_() + sweepTime;
+    schedule_(sweepDue);
+    addrLimit.setRate(100, 200);
+    prefixLimit.setRate(1000, 2000);
+    secret.resize(32);
+    for (qsizetype i = 0; i < secret.size(); i++)secret[i] = (char) QRandomGenerator::system()->generate();
+}
+
+CFUPManager::~CFUPManager() { // 不允许被外部调用
+    for (auto i: live)i->cm = nullptr; // CFUP作为子对象在QObject析构时才删除, 不能再访问管理器
+    transport->cm = nullptr;
+    if (ownTransport)delete transport;
+}
 
 void CFUPManager::deleteLater() {QObject::deleteLater();} // 不允许被外部调用
 
@@ -47,10 +109,13 @@ void CFUPManager::close() { // 这个只是关闭管理器
     };
     rm(cfup);
     rm(connecting);
-    if (ipv4 != nullptr)ipv4->deleteLater();
-    if (ipv6 != nullptr)ipv6->deleteLater();
-    ipv4 = nullptr;
-    ipv6 = nullptr;
+    for (const auto &i: connectWaiters) { // 关闭之后不会再有连接结果
+        for (auto w: i)resume_(w->handle);
+    }
+    connectWaiters.clear();
+    cids.clear();
+    stopCapture();
+    transport->close();
 }
 
 void CFUPManager::quit() { // delete对象调用它
@@ -62,25 +127,7 @@ void CFUPManager::quit() { // delete对象调用它
 QString CFUPManager::bind(const QString &ipStr, unsigned short port) {
     THREAD_CHECK({}); // 不允许被别的线程调用
     if (isBind() != 0 && !isBindAll)return "CFUP管理器已绑定";
-    QHostAddress ip(ipStr); // 构造QHostAddress对象
-    QUdpSocket **udpTmp = nullptr; // 使用哪个udp, 双重指针
-    auto protocol = ip.protocol(); // 获取ip的协议
-    if (protocol == QUdpSocket::IPv4Protocol)udpTmp = &ipv4; // 如果是ipv4, 获取ipv4的udp指针
-    else if (protocol == QUdpSocket::IPv6Protocol)udpTmp = &ipv6; // 如果是ipv6, 获取ipv6的udp指针
-    if (udpTmp == nullptr) return "IP不正确"; // 如果udpTmp为空, 说明IP不正确
-    auto &udp = (*udpTmp); // 获取udpTmp指向的指针对象
-    QString error; // 错误信息
-    if (udp == nullptr) { // 如果udp是空
-        udp = new QUdpSocket(this); // new对象
-        if (udp->bind(ip, port)) // 绑定
-            connect(udp, &QUdpSocket::readyRead, this, &CFUPManager::recv_);
-        else { // 绑定失败
-            error = udp->errorString();
-            delete udp;
-            udp = nullptr;
-        }
-    } else error = "CFUP管理器已绑定"; // 否则CFUP已绑定
-    return error;
+    return transport->bind(QHostAddress(ipStr), port); // 由传输层检查IP和是否已经绑定
 }
 
 QStringList CFUPManager::bind(unsigned short port) { // 同时绑定ipv4和ipv6
@@ -102,43 +149,258 @@ void CFUPManager::connectToHost(const QString &ipStr, unsigned short port) {
 
 void CFUPManager::connectToHost(const QHostAddress &ip, unsigned short port) {
     THREAD_CHECK(); // 检查线程
-    QUdpSocket *udp = nullptr;
+    connectToHost(ip, port, QByteArray());
+}
+
+void CFUPManager::connectToHost(const QHostAddress &ip, unsigned short port, const QByteArray &data) {
+    THREAD_CHECK(); // 检查线程
+    int need = 0;
     auto protocol = ip.protocol();
-    if (protocol == QUdpSocket::IPv4Protocol)udp = ipv4;
-    else if (protocol == QUdpSocket::IPv6Protocol)udp = ipv6;
-    if (udp == nullptr) { // IP协议检查失败
+    if (protocol == QAbstractSocket::IPv4Protocol)need = 1;
+    else if (protocol == QAbstractSocket::IPv6Protocol)need = 2;
+    if ((transport->isBind() & need) == 0) { // IP协议检查失败
         emit connectFail(ip, port, "以目标IP协议所管理的CFUP管理器未绑定");
+        connectDone_(ip, port, nullptr);
         return;
     }
     if ((cfup.size() >= connectNum)) {
         emit connectFail(ip, port, "当前管理器连接的CFUP数量已达到上限");
+        connectDone_(ip, port, nullptr);
         return;
     }
     auto ipPort = IPPort(ip, port);
     if (cfup.contains(ipPort)) {
-        emit connected(cfup[ipPort]);
+        auto c = cfup[ipPort];
+        emit connected(c);
+        connectDone_(ip, port, c);
+        if (!data.isEmpty())c->send(data);
         return;
     }
     if (!connecting.contains(ipPort)) {
         auto tmp = new CFUP(this, ip, port);
         connecting[ipPort] = tmp;
         connect(tmp, &CFUP::disconnected, this, &CFUPManager::requestInvalid_);
-        tmp->connectToHost_();
+        tmp->earlyData = data;
+        QByteArray ticket;
+        if (!data.isEmpty() && data.size() <= tmp->dataBlockSize)ticket = tickets.take(ipPort); // 票据只能使用一次
+        tmp->connectToHost_(ticket);
+    } else if (!data.isEmpty() && connecting[ipPort]->earlyData.isEmpty())connecting[ipPort]->earlyData = data; // 已经在连接中, 连接成功后发送
+}
+
+int CFUPManager::broadcast(const QList<CFUP *> &cs, const QByteArray &data, unsigned char priority) {
+    THREAD_CHECK(0); // 不允许被别的线程调用
+    if (data.isEmpty())return 0;
+    if (priority >= CFUP_PRIORITIES)priority = CFUP_PRIORITIES - 1;
+    auto now = clockUs_();
+    QByteArray packed; // 协商了压缩的连接共用一份压缩结果, 第一次需要时才压缩
+    int num = 0;
+    for (auto c: cs) {
+        if (c == nullptr || c->cm != this || c->cs != 1)continue;
+        if (c->compress && packed.isEmpty())packed = c->encode_(data);
+        c->sendBufLv2[priority].msgs.append({c->compress ? packed : data, now, ++c->msgQueued, true});
+        c->postWnd_();
+        num++;
+    }
+    return num;
+}
+
+int CFUPManager::broadcast(const QByteArray &data, unsigned char priority) {
+    THREAD_CHECK(0); // 不允许被别的线程调用
+    return broadcast(cfup.values(), data, priority);
+}
+
+void CFUPManager::setStatelessHandshake(bool enable) {
+    THREAD_CHECK(); // 不允许被别的线程调用
+    stateless = enable;
+}
+
+bool CFUPManager::isStatelessHandshake() {
+    THREAD_CHECK(false); // 不允许被别的线程调用
+    return stateless;
+}
+
+void CFUPManager::setAdmissionLimit(double addrRate, double addrBurst, double prefixRate, double prefixBurst) {
+    THREAD_CHECK(); // 不允许被别的线程调用
+    addrLimit.setRate(addrRate, addrBurst);
+    prefixLimit.setRate(prefixRate, prefixBurst);
+}
+
+CFUPAdmissionStats CFUPManager::getAdmissionStats() {
+    THREAD_CHECK({}); // 不允许被别的线程调用
+    return admission;
+}
+
+QString CFUPManager::startCapture(const QString &path, long long maxBytes, int maxFiles) {
+    THREAD_CHECK({}); // 不允许被别的线程调用
+    stopCapture();
+    auto tmp = new PcapWriter(path, maxBytes, maxFiles);
+    auto error = tmp->open();
+    if (!error.isEmpty()) {
+        delete tmp;
+        return error;
+    }
+    capture = tmp;
+    captureBase = wallMs_() * 1000 - clockUs_();
+    return {};
+}
+
+void CFUPManager::stopCapture() {
+    THREAD_CHECK(); // 不允许被别的线程调用
+    delete capture; // 析构时写入缓冲
+    capture = nullptr;
+}
+
+CFUPManagerStats CFUPManager::getStats() {
+    THREAD_CHECK({}); // 不允许被别的线程调用
+    auto tmp = stats;
+    tmp.connected = cfup.size();
+    tmp.connecting = connecting.size();
+    return tmp;
+}
+
+void CFUPManager::setCompression(bool enable) {
+    THREAD_CHECK(); // 不允许被别的线程调用
+    compress = enable;
+}
+
+bool CFUPManager::isCompression() {
+    THREAD_CHECK(false); // 不允许被别的线程调用
+    return compress;
+}
+
+void CFUPManager::setConfig(const CFUPConfig &c) {
+    THREAD_CHECK(); // 不允许被别的线程调用
+    config = c;
+    config.wndSize = qBound(1u, c.wndSize, c.SID32 ? 1048576u : 32767u); // 16位SID的窗口不能超过SID空间的一半, 否则无法区分重发包
+    config.dataBlockSize = qBound((unsigned short) 16, c.dataBlockSize, (unsigned short) 65516);
+    config.hbtTime = qMax(c.hbtTime, (unsigned short) 100);
+    config.timeout = qMax(c.timeout, (unsigned short) 10);
+}
+
+CFUPConfig CFUPManager::getConfig() {
+    THREAD_CHECK({}); // 不允许被别的线程调用
+    return config;
+}
+
+void CFUPManager::setPMTUD(bool enable, unsigned short mtu) {
+    THREAD_CHECK(); // 不允许被别的线程调用
+    pmtud = enable;
+    pmtuMtu = qMax(mtu, (unsigned short) 1280); // IPv6最小MTU
+    transport->setDontFragment(enable); // 设置DF之后超过路径MTU的数据包会被丢弃而不是分片, 探测包才有意义
+}
+
+bool CFUPManager::isPMTUD() {
+    THREAD_CHECK(false); // 不允许被别的线程调用
+    return pmtud;
+}
+
+void CFUPManager::recv_(const QHostAddress &IP, unsigned short port, const QByteArray &data) { // 来源于传输层调用, 不会被别的线程调用, 是私有函数
+    stats.packetsRecv++;
+    stats.bytesRecv += data.size();
+    if (capture != nullptr) {
+        auto protocol = IP.protocol();
+        capture->write(captureBase + clockUs_(), IP, port, transport->localAddress(protocol), transport->localPort(protocol), data);
     }
+    if (data.isEmpty())return;
+    if (isSignalConnected(QMetaMethod::fromSignal(&CFUPManager::cLog)))emit cLog("↓ " + IPPort(IP, port) + " : " + bytesToHexString(data));
+    proc_(IP, port, data);
 }
 
-void CFUPManager::recv_() { // 来源于udpSocket信号调用, 不会被别的线程调用, 是私有函数
-    auto udp = (QUdpSocket *) sender();
-    while (udp->hasPendingDatagrams()) {
-        auto datagrams = udp->receiveDatagram();
-        auto IP = datagrams.senderAddress();
-        auto port = datagrams.senderPort();
-        auto data = datagrams.data();
-        if (!data.isEmpty()) {
-            emit cLog("↓ " + IPPort(IP, port) + " : " + bytesToHexString(data));
-            proc_(IP, port, data);
+void CFUPManager::poll_() {
+    drain_();
+    auto now = clock_();
+    wakeAt = 0;
+    while (!timers.isEmpty() && timers.firstKey() <= now) { // 到期的重发定时器
+        auto it = timers.begin();
+        auto due = it.key();
+        auto key = it.value();
+        timers.erase(it);
+        auto c = live.value(key.first, nullptr);
+        if (c == nullptr)continue; // CFUP已经删除
+        auto cdpt = c->sendWnd.value(key.second, nullptr);
+        if (cdpt == nullptr || cdpt->due != due)continue; // 已经应答, 或者已经重新计时
+        cdpt->due = 0;
+        c->sendTimeout_(cdpt);
+    }
+    while (!posted.isEmpty() || !readable.isEmpty() || !ready.isEmpty()) { // 同一轮事件处理中多次send只更新一次窗口, 多个消息只触发一次readyRead
+        auto tmp = posted;
+        posted.clear();
+        for (auto i: tmp) {
+            auto c = live.value(i, nullptr);
+            if (c == nullptr)continue;
+            c->wndPending = false;
+            c->updateWnd_();
         }
+        tmp = readable;
+        readable.clear();
+        for (auto i: tmp) {
+            auto c = live.value(i, nullptr);
+            if (c != nullptr)c->notifyRead_();
+        }
+        auto handles = ready;
+        ready.clear();
+        for (auto h: handles)h.resume(); // 直接在这里恢复协程, 协程中再次send或者co_await会在下一次循环处理
+    }
+    if (now >= sweepDue) {
+        sweepDue = now + sweepTime;
+        hbtSweep_();
     }
+    auto next = sweepDue;
+    if (!timers.isEmpty() && timers.firstKey() < next)next = timers.firstKey();
+    schedule_(next);
+}
+
+long long CFUPManager::clock_() {
+    return transport->monotonicUs() / 1000;
+}
+
+long long CFUPManager::clockUs_() {
+    return transport->monotonicUs();
+}
+
+long long CFUPManager::wallMs_() {
+    return transport->wallMs();
+}
+
+unsigned int CFUPManager::random_() {
+    return transport->random();
+}
+
+void CFUPManager::schedule_(long long time) {
+    if (wakeAt != 0 && wakeAt <= time)return; // 已经有更早的唤醒
+    wakeAt = time;
+    transport->wake(time);
+}
+
+void CFUPManager::addTimer_(unsigned long long c, unsigned int SID, long long due) {
+    timers.insert(due, {c, SID});
+    schedule_(due);
+}
+
+void CFUPManager::submit_(unsigned long long c, SubmitQueue::Op op, const QByteArray &data, unsigned char priority) {
+    if (submits.push({c, op, data, priority}))transport->notify(); // 只有队列从空闲变为待处理时才唤醒
+}
+
+void CFUPManager::drain_() {
+    submits.rearm(); // 先清除唤醒标记, 取出过程中的提交会重新唤醒
+    SubmitQueue::Item item;
+    while (submits.pop(item)) {
+        auto c = live.value(item.serial, nullptr);
+        if (c == nullptr)continue; // CFUP已经删除
+        if (item.op == SubmitQueue::SEND)c->send(item.data, item.priority);
+        else if (item.op == SubmitQueue::SEND_NOW)c->sendNow(item.data);
+        else if (item.op == SubmitQueue::CLOSE)c->close(item.data);
+    }
+}
+
+void CFUPManager::post_(CFUP *c) {
+    posted.append(c->serial);
+    schedule_(clock_());
+}
+
+void CFUPManager::postRead_(CFUP *c) {
+    readable.append(c->serial);
+    schedule_(clock_());
 }
 
 void CFUPManager::setMaxConnectNum(int num) {
@@ -158,20 +420,19 @@ int CFUPManager::getConnectedNum() {
 
 int CFUPManager::isBind() { // 已经绑定, 1表示只绑定了IPv4, 2表示只绑定了IPv6, 3表示IPv4和IPv6都绑定了
     THREAD_CHECK(-1); // 不允许被别的线程调用
-    int tmp = 0;
-    if (ipv4 != nullptr)tmp |= 1;
-    if (ipv6 != nullptr)tmp |= 2;
-    return tmp;
+    return transport->isBind();
 }
 
-void CFUPManager::send_(const QHostAddress &IP, unsigned short port, const QByteArray &data) {
-    QUdpSocket *udp = nullptr;
-    auto protocol = IP.protocol();
-    if (protocol == QUdpSocket::IPv4Protocol)udp = ipv4;
-    else if (protocol == QUdpSocket::IPv6Protocol)udp = ipv6;
-    if (udp == nullptr)return;
-    udp->writeDatagram(data, IP, port);
-    emit cLog("↑ " + IPPort(IP, port) + " : " + bytesToHexString(data));
+void CFUPManager::send_(const QHostAddress &IP, unsigned short port, const QByteArray &head, const QByteArray &body, bool fragment) {
+    if (fragment)transport->sendFragmentable(IP, port, head, body);
+    else transport->send(IP, port, head, body);
+    stats.packetsSent++;
+    stats.bytesSent += head.size() + body.size();
+    if (capture != nullptr) {
+        auto protocol = IP.protocol();
+        capture->write(captureBase + clockUs_(), transport->localAddress(protocol), transport->localPort(protocol), IP, port, head + body);
+    }
+    if (isSignalConnected(QMetaMethod::fromSignal(&CFUPManager::cLog)))emit cLog("↑ " + IPPort(IP, port) + " : " + bytesToHexString(head + body)); // 格式化十六进制的开销很大, 没有连接时跳过
 }
 
 bool CFUPManager::threadCheck_(const QString &funcName) {
@@ -189,11 +450,22 @@ void CFUPManager::cfupConnected_(CFUP *c) { // 当CFUP处理后连接成功调
         disconnect(c, &CFUP::disconnected, this, &CFUPManager::requestInvalid_); // 断开连接
         connect(c, &CFUP::disconnected, this, &CFUPManager::rmCFUP_);
         cfup[key] = c;
+        if (pmtud)c->pmtuStart_();
+        stats.handshakeSucceeded++;
+        if (!c->initiative) {
+            c->CID = newCID_();
+            cids[c->CID] = c;
+            c->sendEX_(EX_CID, dump(c->CID)); // 下发连接ID, 对方地址变化后连接不会中断
+            c->sendEX_(EX_TICKET, newTicket_()); // 下发会话票据, 对方下次可以0-RTT重连
+        }
         emit connected(c);
+        if (c->initiative)connectDone_(c->IP, c->port, c);
     } else {
+        stats.handshakeFailed++;
         c->close("当前连接的CFUP数量已达到上限");
         c->deleteLater();
         if (c->initiative)emit connectFail(c->IP, c->port, "当前连接的CFUP数量已达到上限");
+        if (c->initiative)connectDone_(c->IP, c->port, nullptr);
     }
 }
 
@@ -201,10 +473,198 @@ void CFUPManager::requestInvalid_(const QByteArray &data) {
     auto c = (CFUP *) sender();
     c->deleteLater();
     connecting.remove(IPPort(c->IP, c->port));
+    stats.handshakeFailed++;
     if (c->initiative)emit connectFail(c->IP, c->port, data); // 如果是主动连接的触发连接失败
+    if (c->initiative)connectDone_(c->IP, c->port, nullptr);
 }
 
 void CFUPManager::rmCFUP_() {
     auto c = (CFUP *) sender();
     cfup.remove(IPPort(c->IP, c->port));
+    if (c->CID != 0 && !c->initiative)cids.remove(c->CID);
+}
+
+unsigned int CFUPManager::newCID_() {
+    unsigned int CID = 0;
+    while (CID == 0 || cids.contains(CID))CID = random_();
+    return CID;
+}
+
+bool CFUPManager::migrate_(CFUP *c, const QHostAddress &IP, unsigned short port) {
+    auto key = IPPort(IP, port);
+    if (key.isEmpty() || cfup.contains(key) || connecting.contains(key))return false; // 新地址已经被占用
+    cfup.remove(IPPort(c->IP, c->port));
+    c->IP = IP;
+    c->port = port;
+    cfup[key] = c;
+    return true;
+}
+
+void CFUPManager::hbtSweep_() { // 统一检查所有已连接的CFUP是否需要发送心跳和探测包
+    auto now = clock_();
+    for (auto i: cfup) {
+        i->heartbeat_(now);
+        i->pmtud_(now);
+    }
+    auto wall = wallMs_(); // 票据过期时间是绝对时间
+    for (auto i = usedTickets.begin(); i != usedTickets.end();) { // 清理已经过期的票据nonce
+        if (i.value() < wall)i = usedTickets.erase(i);
+        else ++i;
+    }
+    if (capture != nullptr)capture->flush(); // 抓包缓冲最多延迟一个扫描间隔写入文件
+}
+
+bool CFUPManager::admit_(const QHostAddress &IP) {
+    auto now = clock_();
+    auto addr = IP.toIPv6Address(); // IPv4会被映射为::ffff:a.b.c.d
+    QByteArray key((const char *) &addr, sizeof(addr));
+    if (!addrLimit.take(key, now)) {
+        admission.addrRejected++;
+        return false;
+    }
+    if (IP.protocol() == QAbstractSocket::IPv4Protocol)key[15] = 0; // /24
+    else for (int i = 6; i < 16; i++)key[i] = 0; // /48
+    if (!prefixLimit.take(key, now)) {
+        admission.prefixRejected++;
+        return false;
+    }
+    return true;
+}
+
+QByteArray CFUPManager::cookie_(const QHostAddress &IP, unsigned short port, long long slice) { // HMAC(密钥, IP + port + 时间片)前8字节
+    auto addr = IP.toIPv6Address();
+    QMessageAuthenticationCode mac(QCryptographicHash::Sha256, secret);
+    mac.addData((const char *) &addr, sizeof(addr));
+    mac.addData(dump(port));
+    mac.addData(dump(slice));
+    return mac.result().left(8);
+}
+
+void CFUPManager::cookieRC_ACK_(const QHostAddress &IP, unsigned short port, const QByteArray &reply) {
+    auto now = wallMs_();
+    QByteArray data;
+    data.append((char) 0x43); // RC ACK UD
+    data += dump((unsigned short) 0); // SID
+    data += dump(now); // 发送时间
+    data += dump((unsigned short) 0); // AID
+    data += dumpTLV(TLV_COOKIE, cookie_(IP, port, now / cookieTime));
+    data += reply; // 协商结果
+    send_(IP, port, data);
+}
+
+void CFUPManager::cookieACK_(const QHostAddress &IP, unsigned short port, const QByteArray &data) {
+    if (data.size() < 3)return;
+    unsigned short AID = *(unsigned short *) (data.data() + 1);
+    if (AID != 0)return;
+    QHash<unsigned char, QByteArray> tlv;
+    if (!parseTLV(data.mid(3), tlv))return;
+    auto value = tlv.value(TLV_COOKIE);
+    if (value.size() != 8)return;
+    if (cfup.size() >= connectNum)return; // 连接上限
+    if (!admit_(IP))return; // 每个cookie应答都要计算HMAC, 与RC共用准入限制
+    auto slice = wallMs_() / cookieTime;
+    if (value != cookie_(IP, port, slice) && value != cookie_(IP, port, slice - 1))return; // cookie不正确或已过期
+    QHash<unsigned char, QByteArray> agreed;
+    parseTLV(negotiate_(tlv), agreed); // 对方在NA ACK中重复了握手提议, 重新协商即可, 不需要保存状态
+    auto tmp = new CFUP(this, IP, port);
+    tmp->apply_(agreed);
+    tmp->accept_();
+}
+
+QByteArray CFUPManager::hello_() { // 主动方在RC中携带的握手提议
+    QByteArray tmp;
+    if (compress)tmp += dumpTLV(TLV_COMPRESS, QByteArray(1, (char) 0x01));
+    auto params = dumpParams_(config);
+    if (params != dumpParams_({}))tmp += dumpTLV(TLV_PARAMS, params); // 默认参数不需要提议
+    return tmp;
+}
+
+QByteArray CFUPManager::negotiate_(const QHash<unsigned char, QByteArray> &tlv) { // 被动方根据对方提议和自己的设置协商, 返回RC ACK携带的协商结果
+    QByteArray tmp;
+    auto codec = tlv.value(TLV_COMPRESS);
+    if (compress && !codec.isEmpty() && (codec[0] & 0x01))tmp += dumpTLV(TLV_COMPRESS, QByteArray(1, (char) 0x01)); // 双方都支持zlib
+    CFUPConfig peer; // 对方没有提议时使用默认参数
+    if (tlv.contains(TLV_PARAMS) && !parseParams_(tlv.value(TLV_PARAMS), peer))peer = CFUPConfig();
+    CFUPConfig agreed; // 每一项取双方较小值
+    agreed.SID32 = config.SID32 && peer.SID32;
+    agreed.interleave = config.interleave && peer.interleave;
+    agreed.wndSize = qMin(config.wndSize, peer.wndSize);
+    if (!agreed.SID32)agreed.wndSize = qMin(agreed.wndSize, 32767u);
+    agreed.dataBlockSize = qMin(config.dataBlockSize, peer.dataBlockSize);
+    agreed.hbtTime = qMin(config.hbtTime, peer.hbtTime);
+    auto params = dumpParams_(agreed);
+    if (params != dumpParams_({}))tmp += dumpTLV(TLV_PARAMS, params); // 协商结果是默认参数时不需要回复
+    return tmp;
+}
+
+QByteArray CFUPManager::dumpParams_(const CFUPConfig &c) {
+    QByteArray tmp;
+    tmp += dump(c.wndSize);
+    tmp += dump(c.dataBlockSize);
+    tmp += dump(c.hbtTime);
+    tmp.append((char) ((c.SID32 ? 0x01 : 0x00) | (c.interleave ? 0x02 : 0x00)));
+    return tmp;
+}
+
+bool CFUPManager::parseParams_(const QByteArray &data, CFUPConfig &c) {
+    if (data.size() < 9)return false;
+    auto wnd = *(unsigned int *) data.data();
+    auto dbs = *(unsigned short *) (data.data() + 4);
+    auto hbt = *(unsigned short *) (data.data() + 6);
+    bool SID32 = data[8] & 0x01;
+    bool interleave = data[8] & 0x02;
+    if (wnd == 0 || wnd > (SID32 ? 1048576u : 32767u) || dbs < 16 || dbs > 65516 || hbt < 100)return false; // 超出范围
+    c.wndSize = wnd;
+    c.dataBlockSize = dbs;
+    c.hbtTime = hbt;
+    c.SID32 = SID32;
+    c.interleave = interleave;
+    return true;
+}
+
+QByteArray CFUPManager::newTicket_() {
+    QByteArray ticket = dump(wallMs_() + ticketTime);
+    ticket += dump((long long) QRandomGenerator::system()->generate64());
+    QMessageAuthenticationCode mac(QCryptographicHash::Sha256, secret);
+    mac.addData(QByteArray(1, 'T')); // 与cookie区分
+    mac.addData(ticket);
+    return ticket + mac.result().left(8);
+}
+
+bool CFUPManager::checkTicket_(const QByteArray &ticket) {
+    if (ticket.size() != 24)return false;
+    QMessageAuthenticationCode mac(QCryptographicHash::Sha256, secret);
+    mac.addData(QByteArray(1, 'T'));
+    mac.addData(ticket.left(16));
+    if (mac.result().left(8) != ticket.mid(16))return false; // 票据被篡改
+    long long expire = *(long long *) ticket.data();
+    if (expire < wallMs_())return false; // 票据已过期
+    auto nonce = ticket.mid(8, 8);
+    if (usedTickets.contains(nonce))return false; // 重放
+    usedTickets[nonce] = expire;
+    return true;
+}
+
+void CFUPTransport::deliver_(const QHostAddress &IP, unsigned short port, const QByteArray &data) {
+    if (cm != nullptr)cm->recv_(IP, port, data);
+}
+
+void CFUPTransport::poll_() {
+    if (cm != nullptr)cm->poll_();
+}
+
+void CFUPTransport::sendFragmentable(const QHostAddress &IP, unsigned short port, const QByteArray &head, const QByteArray &body) {
+    send(IP, port, head, body);
+}
+
+long long CFUPTransport::monotonicUs() {
+    return steadyUs();
+}
+
+long long CFUPTransport::wallMs() {
+    return QDateTime::currentMSecsSinceEpoch();
+}
+
+unsigned int CFUPTransport::random() {
+    return QRandomGenerator::global()->generate();
 }
@@ -3,15 +3,29 @@
 #include <QHostAddress>
 #include <QObject>
 #include <QHash>
+#include <QMap>
+#include "RateLimiter.h"
+#include "CFUP.h"
+#include "CFUPTransport.h"
+#include "SubmitQueue.h"
 
-class CFUP;
-class QUdpSocket;
+class PcapWriter;
+
+class CFUPAdmissionStats { // RC准入统计, 无状态握手时包含带cookie的NA ACK
+public:
+    unsigned long long admitted = 0; // 通过的RC
+    unsigned long long addrRejected = 0; // 单地址超限被拒绝的RC, cookie应答和C NA回复
+    unsigned long long prefixRejected = 0; // 单网段超限被拒绝的RC, cookie应答和C NA回复
+    unsigned long long fullRejected = 0; // 连接数量达到上限被拒绝的RC
+};
 
 class CFUPManager final : public QObject {
 Q_OBJECT
 
 public:
-    explicit CFUPManager(QObject * = nullptr);
+    explicit CFUPManager(QObject * = nullptr); // 使用Qt事件循环驱动的传输层
+
+    explicit CFUPManager(CFUPTransport *, QObject * = nullptr); // 使用指定的传输层, 传输层由调用方管理, 需要比管理器活得更久
 
     QString bind(const QString &, unsigned short); // 绑定
 
@@ -29,13 +43,47 @@ public:
 
     void connectToHost(const QHostAddress &, unsigned short);
 
+    void connectToHost(const QHostAddress &, unsigned short, const QByteArray &); // 连接并发送第一条数据, 有对方的会话票据时数据随RC一起发送(0-RTT)
+
+    int broadcast(const QList<CFUP *> &, const QByteArray &, unsigned char = PRIORITY_NORMAL); // 向多个连接发送同一条消息, 只压缩一次, 所有连接的分片共享数据, 返回发送的连接数量
+
+    int broadcast(const QByteArray &, unsigned char = PRIORITY_NORMAL); // 向所有已连接的CFUP广播
+
+    CFUPConnectAwaiter asyncConnect(const QHostAddress &, unsigned short, const QByteArray & = {}); // 同connectToHost, co_await得到连接成功的CFUP, 失败或者在其他线程调用为nullptr
+
+    void setStatelessHandshake(bool); // 设置无状态握手, 开启后收到RC不会创建CFUP对象, 而是回复带cookie的RC ACK
+
+    bool isStatelessHandshake(); // 是否开启无状态握手
+
+    void setAdmissionLimit(double, double, double, double); // 设置RC准入限制: 单地址每秒数量, 单地址突发数量, 单网段每秒数量, 单网段突发数量, 每秒数量<=0表示不限制
+
+    CFUPAdmissionStats getAdmissionStats(); // 获取RC准入统计
+
+    CFUPManagerStats getStats(); // 获取统计快照
+
+    QString startCapture(const QString &, long long = 64 * 1024 * 1024, int = 4); // 开始抓包(pcap格式): 文件路径, 单个文件大小上限, 保留的文件数量, 返回错误信息
+
+    void stopCapture(); // 停止抓包
+
+    void setCompression(bool); // 设置消息压缩, 只对之后的握手有效, 双方都开启才会生效
+
+    bool isCompression(); // 是否开启消息压缩
+
+    void setConfig(const CFUPConfig &); // 设置连接参数, 只对之后的握手有效, 超出范围的值会被修正
+
+    CFUPConfig getConfig(); // 获取连接参数
+
+    void setPMTUD(bool, unsigned short = 1500); // 设置路径MTU探测和本地链路MTU, 开启后套接字设置DF, 数据块大小从1005开始探测, 上限取握手协商的数据块大小和链路MTU减去IP, UDP和CFUP头部中较小的一个, 探测1005以上需要双方都调大CFUPConfig::dataBlockSize
+
+    bool isPMTUD(); // 是否开启路径MTU探测
+
 signals:
 
     void connectFail(const QHostAddress &, unsigned short, const QByteArray &); // 我方主动连接连接失败
 
     void connected(CFUP *); // 连接成功(包含我方主动与对方请求)
 
-    void cLog(const QString &);
+    void cLog(const QString &); // 数据包日志, 没有连接时不会格式化数据包
 
 public slots:
 
@@ -46,22 +94,80 @@ private slots:
 
     void deleteLater();
 
-    void recv_(); // 接收数据
-
     void rmCFUP_();
 private:
     QHash<QString, CFUP *> cfup; // 已连接的
     int connectNum = 65535; // 最大连接数量
     QHash<QString, CFUP *> connecting; // 连接中的cfup
-    QUdpSocket *ipv4 = nullptr;
-    QUdpSocket *ipv6 = nullptr;
+    QHash<unsigned int, CFUP *> cids; // 按连接ID索引的cfup, 对方地址变化后仍能找到连接
+    CFUPTransport *transport = nullptr; // 传输层
+    bool ownTransport = false; // 传输层由管理器创建, 析构时一起删除
     bool isBindAll = false; // 判断是否是调用的QStringList bind(unsigned short);函数
+    QMultiMap<long long, QPair<unsigned long long, unsigned int>> timers; // 重发定时器: 到期时间 -> (CFUP序号, SID), 停止的定时器到期时才删除
+    QHash<unsigned long long, CFUP *> live; // 按序号索引的所有CFUP
+    unsigned long long serial = 0; // 最后分配的CFUP序号
+    QList<unsigned long long> posted; // 需要延迟更新窗口的CFUP序号
+    QList<unsigned long long> readable; // 有新消息, 需要在本轮结束时触发readyRead的CFUP序号
+    QHash<QString, QList<CFUPConnectAwaiter *>> connectWaiters; // 等待连接结果的协程
+    QList<std::coroutine_handle<>> ready; // 本轮事件处理结束时恢复的协程
+    SubmitQueue submits; // 其他线程提交的CFUP操作
+    long long wakeAt = 0; // 已经请求传输层唤醒的时间, 0表示没有
+    long long sweepDue = 0; // 下一次心跳扫描的时间
+    unsigned short sweepTime = 1000; // 心跳扫描间隔
+    bool stateless = false; // 无状态握手
+    QByteArray secret; // cookie密钥, 每个管理器随机生成
+    unsigned short cookieTime = 10000; // cookie时间片长度, cookie在当前和上一个时间片内有效
+    RateLimiter addrLimit; // 按来源地址限制RC
+    RateLimiter prefixLimit; // 按来源网段限制RC, IPv4为/24, IPv6为/48
+    CFUPAdmissionStats admission; // RC准入统计
+    CFUPManagerStats stats; // 统计计数, 连接数量在获取快照时填写
+    PcapWriter *capture = nullptr; // 抓包
+    long long captureBase = 0; // 抓包时间戳 = captureBase + 单调时钟, 开始抓包时对齐到传输层的墙上时钟, 模拟网络中为虚拟时间
+    QHash<QString, QByteArray> tickets; // 对方下发的会话票据, 用于0-RTT重连, 只能使用一次
+    QHash<QByteArray, long long> usedTickets; // 已使用的票据nonce和过期时间, 防重放
+    unsigned int ticketTime = 3600000; // 票据有效期
+    bool compress = false; // 消息压缩
+    CFUPConfig config; // 连接参数
+    bool pmtud = false; // 路径MTU探测
+    unsigned short pmtuMtu = 1500; // 本地链路MTU, 路径MTU探测的上限
 
     ~CFUPManager() override;
 
+    void init_(); // 构造函数公共部分
+
+    void recv_(const QHostAddress &, unsigned short, const QByteArray &); // 接收数据, 由传输层调用
+
+    void poll_(); // 处理到期的定时器, 延迟的窗口更新和心跳扫描, 由传输层调用
+
+    long long clock_(); // 单调时钟(毫秒), 用于定时器和超时判断
+
+    long long clockUs_(); // 单调时钟(微秒), 用于RTT和消息延迟
+
+    long long wallMs_(); // 墙上时钟(毫秒)
+
+    unsigned int random_(); // 非安全用途的随机数
+
+    void schedule_(long long); // 请求传输层在指定时间唤醒
+
+    void addTimer_(unsigned long long, unsigned int, long long); // 添加重发定时器: CFUP序号, SID, 到期时间
+
+    void post_(CFUP *); // 在本轮事件处理结束时更新窗口
+
+    void postRead_(CFUP *); // 在本轮事件处理结束时触发readyRead
+
+    void resume_(std::coroutine_handle<>); // 在本轮事件处理结束时恢复协程
+
+    void submit_(unsigned long long, SubmitQueue::Op, const QByteArray &, unsigned char); // 任意线程调用, 提交CFUP操作, 由管理器所在线程批量执行
+
+    void drain_(); // 执行其他线程提交的CFUP操作
+
+    void connectDone_(const QHostAddress &, unsigned short, CFUP *); // 主动连接有了结果, 恢复等待的协程
+
+    void hbtSweep_(); // 心跳和路径MTU探测扫描
+
     void proc_(const QHostAddress &, unsigned short, const QByteArray &); // 处理来的信息
 
-    void send_(const QHostAddress &, unsigned short, const QByteArray &); // 发送数据
+    void send_(const QHostAddress &, unsigned short, const QByteArray &, const QByteArray & = {}, bool = false); // 发送数据: 头部, 用户数据, 是否允许IP分片
 
     bool threadCheck_(const QString &); // 线程检查
 
@@ -69,5 +175,35 @@ private:
 
     void requestInvalid_(const QByteArray &);
 
+    bool admit_(const QHostAddress &); // RC准入检查
+
+    QByteArray cookie_(const QHostAddress &, unsigned short, long long); // 计算cookie
+
+    void cookieRC_ACK_(const QHostAddress &, unsigned short, const QByteArray &); // 无状态回复RC ACK
+
+    void cookieACK_(const QHostAddress &, unsigned short, const QByteArray &); // 验证对方带回的cookie
+
+    unsigned int newCID_(); // 分配一个未使用的连接ID
+
+    bool migrate_(CFUP *, const QHostAddress &, unsigned short); // 路径验证通过, 把cfup迁移到新地址
+
+    QByteArray hello_(); // 握手提议
+
+    QByteArray negotiate_(const QHash<unsigned char, QByteArray> &); // 握手协商
+
+    static QByteArray dumpParams_(const CFUPConfig &); // 连接参数: wndSize(4) + dataBlockSize(2) + hbtTime(2) + flags(1)
+
+    static bool parseParams_(const QByteArray &, CFUPConfig &);
+
+    QByteArray newTicket_(); // 生成会话票据: 过期时间(8) + nonce(8) + MAC(8)
+
+    bool checkTicket_(const QByteArray &); // 验证并作废会话票据
+
     friend class CFUP;
+
+    friend class CFUPHandle;
+
+    friend class CFUPTransport;
+
+    friend class CFUPConnectAwaiter;
 };
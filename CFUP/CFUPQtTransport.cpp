@@ -0,0 +1,129 @@
+#include "CFUPQtTransport.h"
+#include <QUdpSocket>
+#include <QNetworkDatagram>
+#include "tools/tools.h"
+
+#if defined(Q_OS_LINUX)
+#include <netinet/in.h>
+#include <sys/socket.h>
+#elif defined(Q_OS_WIN)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+CFUPQtTransport::CFUPQtTransport(QObject *parent) : QObject(parent) {
+    timer.setSingleShot(true);
+    timer.setTimerType(Qt::PreciseTimer); // 重发定时器需要毫秒精度
+    connect(&timer, &QTimer::timeout, this, [this]() {
+        wakeAt = 0;
+        poll_();
+    });
+}
+
+QString CFUPQtTransport::bind(const QHostAddress &ip, unsigned short port) {
+    QUdpSocket **udpTmp = nullptr; // 使用哪个udp, 双重指针
+    auto protocol = ip.protocol(); // 获取ip的协议
+    if (protocol == QUdpSocket::IPv4Protocol)udpTmp = &ipv4; // 如果是ipv4, 获取ipv4的udp指针
+    else if (protocol == QUdpSocket::IPv6Protocol)udpTmp = &ipv6; // 如果是ipv6, 获取ipv6的udp指针
+    if (udpTmp == nullptr) return "IP不正确"; // 如果udpTmp为空, 说明IP不正确
+    auto &udp = (*udpTmp); // 获取udpTmp指向的指针对象
+    if (udp != nullptr)return "CFUP管理器已绑定";
+    udp = new QUdpSocket(this); // new对象
+    if (!udp->bind(ip, port)) { // 绑定失败
+        auto error = udp->errorString();
+        delete udp;
+        udp = nullptr;
+        return error;
+    }
+    connect(udp, &QUdpSocket::readyRead, this, &CFUPQtTransport::recv_);
+    dontFragment_(udp);
+    return {};
+}
+
+int CFUPQtTransport::isBind() {
+    int tmp = 0;
+    if (ipv4 != nullptr)tmp |= 1;
+    if (ipv6 != nullptr)tmp |= 2;
+    return tmp;
+}
+
+void CFUPQtTransport::send(const QHostAddress &IP, unsigned short port, const QByteArray &head, const QByteArray &body) {
+    auto udp = udp_(IP.protocol());
+    if (udp != nullptr)udp->writeDatagram(body.isEmpty() ? head : head + body, IP, port); // QUdpSocket不支持分散聚集, 只能拼接
+}
+
+void CFUPQtTransport::sendFragmentable(const QHostAddress &IP, unsigned short port, const QByteArray &head, const QByteArray &body) {
+    auto udp = udp_(IP.protocol());
+    if (!df || udp == nullptr) {
+        send(IP, port, head, body);
+        return;
+    }
+    dontFragment_(udp, true); // writeDatagram是同步发送, 发送之后立即恢复DF
+    udp->writeDatagram(body.isEmpty() ? head : head + body, IP, port);
+    dontFragment_(udp);
+}
+
+void CFUPQtTransport::wake(long long time) {
+    if (timer.isActive() && wakeAt <= time)return; // 已经有更早的唤醒
+    wakeAt = time;
+    auto delay = time - steadyUs() / 1000;
+    timer.start((int) (delay < 0 ? 0 : delay));
+}
+
+void CFUPQtTransport::notify() { // 跨线程投递一个事件, 管理器已经合并了唤醒
+    QMetaObject::invokeMethod(this, [this]() {poll_();}, Qt::QueuedConnection);
+}
+
+void CFUPQtTransport::setDontFragment(bool enable) {
+    df = enable;
+    if (ipv4 != nullptr)dontFragment_(ipv4);
+    if (ipv6 != nullptr)dontFragment_(ipv6);
+}
+
+QHostAddress CFUPQtTransport::localAddress(QAbstractSocket::NetworkLayerProtocol protocol) {
+    auto udp = udp_(protocol);
+    return udp == nullptr ? QHostAddress() : udp->localAddress();
+}
+
+unsigned short CFUPQtTransport::localPort(QAbstractSocket::NetworkLayerProtocol protocol) {
+    auto udp = udp_(protocol);
+    return udp == nullptr ? 0 : udp->localPort();
+}
+
+void CFUPQtTransport::close() {
+    if (ipv4 != nullptr)ipv4->deleteLater();
+    if (ipv6 != nullptr)ipv6->deleteLater();
+    ipv4 = nullptr;
+    ipv6 = nullptr;
+}
+
+void CFUPQtTransport::recv_() { // 来源于udpSocket信号调用
+    auto udp = (QUdpSocket *) sender();
+    while (udp->hasPendingDatagrams()) {
+        auto datagrams = udp->receiveDatagram();
+        deliver_(datagrams.senderAddress(), datagrams.senderPort(), datagrams.data());
+    }
+    poll_(); // 处理这一批数据包产生的延迟窗口更新
+}
+
+QUdpSocket *CFUPQtTransport::udp_(QAbstractSocket::NetworkLayerProtocol protocol) {
+    if (protocol == QUdpSocket::IPv4Protocol)return ipv4;
+    if (protocol == QUdpSocket::IPv6Protocol)return ipv6;
+    return nullptr;
+}
+
+void CFUPQtTransport::dontFragment_(QUdpSocket *udp, bool fragment) { // 设置DF之后超过路径MTU的数据包会被丢弃而不是分片, 探测包才有意义
+    auto fd = udp->socketDescriptor();
+    if (fd == -1)return;
+    bool on = df && !fragment;
+#if defined(Q_OS_LINUX)
+    int v4 = on ? IP_PMTUDISC_PROBE : (fragment ? IP_PMTUDISC_DONT : IP_PMTUDISC_WANT); // PROBE: 设置DF, 并且不受内核缓存的路径MTU限制; DONT: 不设置DF
+    int v6 = on ? IPV6_PMTUDISC_PROBE : (fragment ? IPV6_PMTUDISC_DONT : IPV6_PMTUDISC_WANT);
+    if (udp == ipv6)setsockopt((int) fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &v6, sizeof(v6));
+    setsockopt((int) fd, IPPROTO_IP, IP_MTU_DISCOVER, &v4, sizeof(v4)); // 双栈的IPv6套接字也会发送IPv4数据包
+#elif defined(Q_OS_WIN)
+    DWORD v = on ? 1 : 0;
+    if (udp == ipv6)setsockopt((SOCKET) fd, IPPROTO_IPV6, IPV6_DONTFRAG, (const char *) &v, sizeof(v));
+    else setsockopt((SOCKET) fd, IPPROTO_IP, IP_DONTFRAGMENT, (const char *) &v, sizeof(v));
+#endif
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QObject>
+#include <QTimer>
+#include "CFUPTransport.h"
+
+class QUdpSocket;
+
+//基于QUdpSocket和QTimer的传输层, 由Qt事件循环驱动, CFUPManager默认使用
+class CFUPQtTransport final : public QObject, public CFUPTransport {
+Q_OBJECT
+
+public:
+    explicit CFUPQtTransport(QObject * = nullptr);
+
+    QString bind(const QHostAddress &, unsigned short) override;
+
+    int isBind() override;
+
+    void send(const QHostAddress &, unsigned short, const QByteArray &, const QByteArray & = {}) override;
+
+    void sendFragmentable(const QHostAddress &, unsigned short, const QByteArray &, const QByteArray & = {}) override;
+
+    void wake(long long) override;
+
+    void notify() override;
+
+    void setDontFragment(bool) override;
+
+    QHostAddress localAddress(QAbstractSocket::NetworkLayerProtocol) override;
+
+    unsigned short localPort(QAbstractSocket::NetworkLayerProtocol) override;
+
+    void close() override;
+
+private slots:
+
+    void recv_(); // 接收数据
+
+private:
+    QUdpSocket *ipv4 = nullptr;
+    QUdpSocket *ipv6 = nullptr;
+    QTimer timer; // 唤醒定时器
+    long long wakeAt = 0; // 当前唤醒时间
+    bool df = false; // DF
+
+    QUdpSocket *udp_(QAbstractSocket::NetworkLayerProtocol); // 按照IP协议选择套接字
+
+    void dontFragment_(QUdpSocket *, bool = false); // 按照df设置套接字, 第二个参数为true时临时允许分片
+};
@@ -0,0 +1,207 @@
+#include "CFUPSimNetwork.h"
+#include <QCoreApplication>
+#include <QEvent>
+#include "tools/tools.h"
+
+CFUPSimTransport::CFUPSimTransport(CFUPSimNetwork *net, const QHostAddress &IP) : net(net), IP(IP) {}
+
+QHostAddress CFUPSimTransport::address_(QAbstractSocket::NetworkLayerProtocol protocol) {
+    if (IP.protocol() != protocol)return {};
+    if (protocol == QAbstractSocket::IPv4Protocol ? port4 == 0 : port6 == 0)return {};
+    return IP;
+}
+
+QString CFUPSimTransport::bind(const QHostAddress &addr, unsigned short p) {
+    auto protocol = addr.protocol();
+    if (protocol != QAbstractSocket::IPv4Protocol && protocol != QAbstractSocket::IPv6Protocol)return "IP地址不正确";
+    if (protocol != IP.protocol())return "模拟主机没有该协议的地址";
+    if (addr != IP && addr != QHostAddress(protocol == QAbstractSocket::IPv4Protocol ? QHostAddress::AnyIPv4 : QHostAddress::AnyIPv6))return "模拟主机没有该地址";
+    auto &port = protocol == QAbstractSocket::IPv4Protocol ? port4 : port6;
+    if (port != 0)return "已经绑定";
+    if (p == 0) { // 分配临时端口
+        while (net->bound.contains(IPPort(IP, net->ephemeral)))net->ephemeral = net->ephemeral == 65535 ? 49152 : net->ephemeral + 1;
+        p = net->ephemeral;
+    }
+    auto key = IPPort(IP, p);
+    if (net->bound.contains(key))return "端口已被占用";
+    net->bound[key] = this;
+    port = p;
+    return {};
+}
+
+int CFUPSimTransport::isBind() {
+    return (port4 != 0 ? 1 : 0) | (port6 != 0 ? 2 : 0);
+}
+
+void CFUPSimTransport::send(const QHostAddress &to, unsigned short toPort, const QByteArray &head, const QByteArray &body) {
+    auto protocol = to.protocol();
+    auto port = protocol == QAbstractSocket::IPv4Protocol ? port4 : port6;
+    if (port == 0 || protocol != IP.protocol())return; // 没有对应协议的套接字
+    net->send_(this, IP, port, to, toPort, body.isEmpty() ? head : head + body);
+}
+
+void CFUPSimTransport::sendFragmentable(const QHostAddress &to, unsigned short toPort, const QByteArray &head, const QByteArray &body) { // 模拟网络不区分分片, 超过MTU也整体到达
+    auto saved = df;
+    df = false;
+    send(to, toPort, head, body);
+    df = saved;
+}
+
+void CFUPSimTransport::wake(long long time) {
+    if (wakeAt != 0 && wakeAt <= time)return; // 已经有更早的唤醒
+    wakeAt = time;
+    CFUPSimNetwork::Event e;
+    e.type = CFUPSimNetwork::WAKE;
+    e.host = this;
+    e.wakeAt = time;
+    net->post_(time * 1000, e);
+}
+
+void CFUPSimTransport::notify() {
+    CFUPSimNetwork::Event e;
+    e.type = CFUPSimNetwork::NOTIFY;
+    e.host = this;
+    net->post_(net->time, e);
+}
+
+void CFUPSimTransport::setDontFragment(bool d) {
+    df = d;
+}
+
+QHostAddress CFUPSimTransport::localAddress(QAbstractSocket::NetworkLayerProtocol protocol) {
+    return address_(protocol);
+}
+
+unsigned short CFUPSimTransport::localPort(QAbstractSocket::NetworkLayerProtocol protocol) {
+    return protocol == QAbstractSocket::IPv4Protocol ? port4 : port6;
+}
+
+void CFUPSimTransport::close() {
+    if (port4 != 0)net->bound.remove(IPPort(IP, port4));
+    if (port6 != 0)net->bound.remove(IPPort(IP, port6));
+    port4 = port6 = 0;
+}
+
+long long CFUPSimTransport::monotonicUs() {
+    return net->time;
+}
+
+long long CFUPSimTransport::wallMs() {
+    return 1700000000000LL + net->time / 1000; // 固定的起始时间, 票据和cookie的结果也可以复现
+}
+
+unsigned int CFUPSimTransport::random() {
+    return net->rng.generate();
+}
+
+CFUPSimNetwork::CFUPSimNetwork(unsigned int seed) : rng(seed) {}
+
+CFUPSimNetwork::~CFUPSimNetwork() {
+    for (auto i: hosts)delete i;
+}
+
+CFUPSimTransport *CFUPSimNetwork::addHost(const QHostAddress &IP) {
+    auto host = new CFUPSimTransport(this, IP);
+    hosts.append(host);
+    return host;
+}
+
+void CFUPSimNetwork::setLink(const CFUPSimLink &l) {
+    link = l;
+}
+
+CFUPSimLink CFUPSimNetwork::getLink() {
+    return link;
+}
+
+void CFUPSimNetwork::setOutage(bool o) {
+    outage = o;
+}
+
+long long CFUPSimNetwork::now() {
+    return time;
+}
+
+CFUPSimStats CFUPSimNetwork::getStats() {
+    return stats;
+}
+
+void CFUPSimNetwork::post_(long long t, const Event &e) {
+    events.insert({t < time ? time : t, ++seq}, e);
+}
+
+void CFUPSimNetwork::send_(CFUPSimTransport *from, const QHostAddress &IP, unsigned short port, const QHostAddress &to, unsigned short toPort, const QByteArray &data) {
+    stats.packets++;
+    stats.bytes += data.size();
+    long long wire = data.size() + (IP.protocol() == QAbstractSocket::IPv4Protocol ? 28 : 48); // 加上IP和UDP头部
+    if (from->df && wire > link.mtu) {
+        stats.tooBig++;
+        return;
+    }
+    long long arrive = time;
+    if (link.rate > 0) { // 上行链路排队
+        auto depart = from->linkFree > time ? from->linkFree : time;
+        if (depart - time > (long long) link.queue * 1000) {
+            stats.overflow++;
+            return;
+        }
+        from->linkFree = depart + wire * 1000000 / link.rate;
+        arrive = from->linkFree;
+    }
+    arrive += (long long) link.delay * 1000;
+    if (link.jitter > 0)arrive += rng.bounded(link.jitter * 1000 + 1);
+    if (outage || (link.loss > 0 && rng.generateDouble() < link.loss)) { // 丢包也占用了上行链路
+        stats.lost++;
+        return;
+    }
+    Event e;
+    e.to = IPPort(to, toPort);
+    e.IP = IP;
+    e.port = port;
+    e.data = data;
+    post_(arrive, e);
+}
+
+void CFUPSimNetwork::inject(const QHostAddress &IP, unsigned short port, const QHostAddress &to, unsigned short toPort, const QByteArray &data) {
+    stats.packets++;
+    stats.bytes += data.size();
+    if (outage) {
+        stats.lost++;
+        return;
+    }
+    Event e;
+    e.to = IPPort(to, toPort);
+    e.IP = IP;
+    e.port = port;
+    e.data = data;
+    post_(time + (long long) link.delay * 1000, e);
+}
+
+bool CFUPSimNetwork::step() {
+    if (events.isEmpty())return false;
+    auto i = events.begin();
+    time = i.key().first;
+    auto e = i.value();
+    events.erase(i);
+    if (e.type == DELIVER) {
+        auto host = bound.value(e.to, nullptr);
+        if (host == nullptr)stats.unreachable++;
+        else {
+            stats.delivered++;
+            host->deliver_(e.IP, e.port, e.data);
+            host->poll_();
+        }
+    } else if (e.type == WAKE) {
+        if (e.host->wakeAt == e.wakeAt) { // 过期的唤醒直接忽略
+            e.host->wakeAt = 0;
+            e.host->poll_();
+        }
+    } else e.host->poll_();
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete); // 断开的CFUP调用了deleteLater
+    return true;
+}
+
+void CFUPSimNetwork::runUntil(long long t) {
+    while (!events.isEmpty() && events.firstKey().first <= t)step();
+    if (time < t)time = t;
+}
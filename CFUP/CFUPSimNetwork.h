@@ -0,0 +1,137 @@
+#pragma once
+
+#include "CFUPTransport.h"
+#include <QHash>
+#include <QMap>
+#include <QRandomGenerator>
+
+class CFUPSimNetwork;
+
+class CFUPSimLink { // 模拟链路参数, 每个主机的上行链路各自排队
+public:
+    int delay = 20; // 单向延迟(毫秒)
+    int jitter = 0; // 额外延迟在0~jitter毫秒之间均匀分布, 会造成乱序
+    double loss = 0; // 丢包率(0~1)
+    long long rate = 0; // 上行带宽(字节/秒), 0表示不限制
+    int queue = 100; // 排队超过该时间(毫秒)的数据包被丢弃
+    int mtu = 1500; // 设置了DF时超过MTU的数据包被丢弃
+};
+
+class CFUPSimStats { // 模拟网络统计
+public:
+    unsigned long long packets = 0; // 发送的数据包
+    unsigned long long bytes = 0; // 发送的字节数(不含IP和UDP头部)
+    unsigned long long delivered = 0; // 到达的数据包
+    unsigned long long lost = 0; // 随机丢包和断网丢弃
+    unsigned long long overflow = 0; // 排队超时丢弃
+    unsigned long long tooBig = 0; // 超过MTU丢弃
+    unsigned long long unreachable = 0; // 目的地址没有绑定
+};
+
+//模拟网络中的一个主机, 由CFUPSimNetwork创建和删除, 时钟和随机数都来自网络
+//模拟网络是单线程的, notify只是在当前虚拟时间安排一次poll_
+class CFUPSimTransport final : public CFUPTransport {
+public:
+    QString bind(const QHostAddress &, unsigned short) override;
+
+    int isBind() override;
+
+    void send(const QHostAddress &, unsigned short, const QByteArray &, const QByteArray & = {}) override;
+
+    void sendFragmentable(const QHostAddress &, unsigned short, const QByteArray &, const QByteArray & = {}) override;
+
+    void wake(long long) override;
+
+    void notify() override;
+
+    void setDontFragment(bool) override;
+
+    QHostAddress localAddress(QAbstractSocket::NetworkLayerProtocol) override;
+
+    unsigned short localPort(QAbstractSocket::NetworkLayerProtocol) override;
+
+    void close() override;
+
+    long long monotonicUs() override;
+
+    long long wallMs() override;
+
+    unsigned int random() override;
+
+private:
+    CFUPSimNetwork *net;
+    QHostAddress IP; // 主机地址, 绑定通配地址时使用它
+    unsigned short port4 = 0; // 已经绑定的端口, 0表示没有绑定
+    unsigned short port6 = 0;
+    long long wakeAt = 0; // 当前唤醒时间(毫秒), 0表示没有
+    long long linkFree = 0; // 上行链路空闲的时间(微秒)
+    bool df = false; // DF
+
+    CFUPSimTransport(CFUPSimNetwork *, const QHostAddress &);
+
+    QHostAddress address_(QAbstractSocket::NetworkLayerProtocol); // 按照IP协议选择本地地址
+
+    friend class CFUPSimNetwork;
+};
+
+//虚拟时间的模拟网络: 所有数据包和唤醒都是按时间排序的事件, 处理一个事件时直接跳到它的时间, 不需要等待
+//丢包, 抖动和主机的随机数使用同一个固定种子的随机数生成器, 相同的参数和种子得到完全相同的结果
+class CFUPSimNetwork final {
+public:
+    explicit CFUPSimNetwork(unsigned int);
+
+    ~CFUPSimNetwork();
+
+    CFUPSimTransport *addHost(const QHostAddress &); // 添加主机, 用它构造CFUPManager, 传输层由网络删除, 要在所有管理器删除之后再删除网络
+
+    void setLink(const CFUPSimLink &); // 设置所有主机的上行链路
+
+    CFUPSimLink getLink();
+
+    void setOutage(bool); // 断网, 之后发送的数据包全部丢弃
+
+    long long now(); // 当前虚拟时间(微秒)
+
+    bool step(); // 处理一个事件, 没有事件返回false
+
+    void runUntil(long long); // 处理事件直到指定的虚拟时间(微秒)
+
+    void inject(const QHostAddress &, unsigned short, const QHostAddress &, unsigned short, const QByteArray &); // 伪造来源地址发送, 不经过任何主机的上行链路, 用于模拟洪水攻击
+
+    CFUPSimStats getStats();
+
+private:
+    enum Type {
+        DELIVER, // 数据包到达
+        WAKE, // 传输层唤醒
+        NOTIFY // 尽快poll_
+    };
+
+    class Event {
+    public:
+        Type type = DELIVER;
+        CFUPSimTransport *host = nullptr; // WAKE和NOTIFY的目标
+        QString to; // DELIVER的目的地址, 到达时才查找, 期间解绑的地址收不到
+        QHostAddress IP; // 来源地址
+        unsigned short port = 0; // 来源端口
+        QByteArray data;
+        long long wakeAt = 0; // WAKE对应的唤醒时间, 与主机当前的不同说明已经过期
+    };
+
+    QMap<QPair<long long, unsigned long long>, Event> events; // (时间, 序号) -> 事件, 同一时间按加入顺序处理
+    unsigned long long seq = 0; // 事件序号
+    long long time = 1000000; // 虚拟时间(微秒), 从1秒开始, 0在管理器中表示没有时间
+    QRandomGenerator rng;
+    QList<CFUPSimTransport *> hosts;
+    QHash<QString, CFUPSimTransport *> bound; // 已经绑定的地址
+    unsigned short ephemeral = 49152; // 绑定端口0时分配的端口
+    CFUPSimLink link;
+    bool outage = false;
+    CFUPSimStats stats;
+
+    void post_(long long, const Event &); // 加入事件
+
+    void send_(CFUPSimTransport *, const QHostAddress &, unsigned short, const QHostAddress &, unsigned short, const QByteArray &); // 经过来源主机的上行链路发送
+
+    friend class CFUPSimTransport;
+};
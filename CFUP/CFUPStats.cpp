@@ -0,0 +1,85 @@
+#include "CFUPStats.h"
+
+// 桶的分布: [0, 32)每个值一个桶, 之后每个2的幂分为16个子桶
+// 最大记录2^41-1, 超过按最大值记录
+
+void CFUPHistogram::record(long long value) {
+    if (value < 0)value = 0;
+    if (value > (1LL << 41) - 1)value = (1LL << 41) - 1;
+    auto i = index_(value);
+    if (i >= counts.size())counts.resize(i + 1); // 只分配到记录过的最大值所在的桶, 新增的元素初始化为0
+    counts[i]++;
+    if (count == 0 || value < min)min = value;
+    if (value > max)max = value;
+    count++;
+    sum += (double) value;
+}
+
+void CFUPHistogram::merge(const CFUPHistogram &other) {
+    if (other.count == 0)return;
+    if (counts.size() < other.counts.size())counts.resize(other.counts.size());
+    for (qsizetype i = 0; i < other.counts.size(); i++)counts[i] += other.counts[i];
+    if (count == 0 || other.min < min)min = other.min;
+    if (other.max > max)max = other.max;
+    count += other.count;
+    sum += other.sum;
+}
+
+long long CFUPHistogram::percentile(double p) const {
+    if (count == 0)return 0;
+    if (p < 0)p = 0;
+    if (p > 100)p = 100;
+    auto target = (unsigned long long) ((double) count * p / 100 + 0.5);
+    if (target == 0)target = 1;
+    unsigned long long n = 0;
+    for (qsizetype i = 0; i < counts.size(); i++) {
+        n += counts[i];
+        if (n >= target) {
+            auto v = value_((int) i);
+            return v < max ? v : max;
+        }
+    }
+    return max;
+}
+
+unsigned long long CFUPHistogram::getCount() const {
+    return count;
+}
+
+long long CFUPHistogram::getMin() const {
+    return min;
+}
+
+long long CFUPHistogram::getMax() const {
+    return max;
+}
+
+double CFUPHistogram::getMean() const {
+    return count == 0 ? 0 : sum / (double) count;
+}
+
+int CFUPHistogram::index_(long long value) {
+    if (value < 32)return (int) value;
+    int shift = 1;
+    while ((value >> shift) >= 32)shift++; // value >> shift在[16, 32)之间
+    return 32 + (shift - 1) * 16 + (int) ((value >> shift) - 16);
+}
+
+long long CFUPHistogram::value_(int i) {
+    if (i < 32)return i;
+    int shift = (i - 32) / 16 + 1;
+    long long sub = (i - 32) % 16 + 16;
+    return ((sub + 1) << shift) - 1;
+}
+
+QString histogramToString(const CFUPHistogram &h) {
+    if (h.getCount() == 0)return "无数据";
+    auto ms = [](double us) { return QString::number(us / 1000, 'f', 3); };
+    return QString("n=%1 mean=%2 p50=%3 p90=%4 p99=%5 max=%6 (ms)")
+            .arg(h.getCount())
+            .arg(ms(h.getMean()))
+            .arg(ms((double) h.percentile(50)))
+            .arg(ms((double) h.percentile(90)))
+            .arg(ms((double) h.percentile(99)))
+            .arg(ms((double) h.getMax()));
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QList>
+#include <QString>
+
+//HDR风格的直方图, 按2的幂分段, 每段16个子桶, 相对误差不超过1/16, 只分配到记录过的最大值所在的桶
+class CFUPHistogram final {
+public:
+    void record(long long); // 记录一个值, 负数按0记录
+
+    void merge(const CFUPHistogram &); // 合并另一个直方图
+
+    long long percentile(double) const; // 百分位数(0~100), 返回所在桶的上界
+
+    unsigned long long getCount() const; // 记录数量
+
+    long long getMin() const;
+
+    long long getMax() const;
+
+    double getMean() const;
+
+private:
+    QList<unsigned int> counts; // 每个桶的数量
+    unsigned long long count = 0; // 记录数量
+    long long min = 0;
+    long long max = 0;
+    double sum = 0;
+
+    static int index_(long long); // 值所在的桶
+
+    static long long value_(int); // 桶的上界
+};
+
+class CFUPStats { // 连接统计快照, 计数只在连接所在线程更新, 不加锁
+public:
+    unsigned long long packetsSent = 0; // 发送的数据包
+    unsigned long long bytesSent = 0; // 发送的字节数
+    unsigned long long packetsRecv = 0; // 接收的数据包
+    unsigned long long bytesRecv = 0; // 接收的字节数
+    unsigned long long messagesSent = 0; // 全部应答的消息
+    unsigned long long messagesRecv = 0; // 交付的消息
+    unsigned long long retransmits = 0; // 超时重发
+    unsigned long long duplicates = 0; // 重复的数据包(已交付或已在接收窗口)
+    unsigned long long outOfWindow = 0; // 超出接收窗口被丢弃的数据包
+    qsizetype sendWnd = 0; // 发送窗口占用
+    qsizetype recvWnd = 0; // 接收窗口占用
+    qsizetype sendBufLv1 = 0; // 发送1级缓存长度
+    qsizetype sendBufLv2 = 0; // 发送2级缓存长度
+    qsizetype readBuf = 0; // 可读缓存长度
+    CFUPHistogram rtt; // ACK往返时间(微秒), 重发的数据包不记录
+    CFUPHistogram latency; // 消息从send到全部应答的时间(微秒)
+};
+
+class CFUPManagerStats { // 管理器统计快照
+public:
+    unsigned long long packetsSent = 0; // 发送的数据包(包含握手和无状态回复)
+    unsigned long long bytesSent = 0; // 发送的字节数
+    unsigned long long packetsRecv = 0; // 接收的数据包
+    unsigned long long bytesRecv = 0; // 接收的字节数
+    unsigned long long handshakeSucceeded = 0; // 握手成功
+    unsigned long long handshakeFailed = 0; // 握手失败(超时, 被拒绝, 连接数量达到上限)
+    qsizetype connected = 0; // 已连接数量
+    qsizetype connecting = 0; // 连接中数量
+    CFUPHistogram rtt; // 所有连接的ACK往返时间(微秒)
+    CFUPHistogram latency; // 所有连接的消息延迟(微秒)
+};
+
+QString histogramToString(const CFUPHistogram &); // 直方图摘要: 数量, 平均值和常用百分位数(毫秒)
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QHostAddress>
+#include <QByteArray>
+
+class CFUPManager;
+
+//传输层接口: 负责UDP套接字和唤醒, CFUPManager只通过这个接口收发数据包和定时
+//收到数据包时调用deliver_, 到达wake指定的时间或者处理完一批数据包之后调用poll_
+//时钟和随机数也由传输层提供, 模拟网络可以替换成虚拟时间和固定种子
+//接口使用QHostAddress和QByteArray, 替换传输层只能去掉Qt事件循环和QUdpSocket, 不能去掉Qt
+class CFUPTransport {
+public:
+    virtual ~CFUPTransport() = default;
+
+    virtual QString bind(const QHostAddress &, unsigned short) = 0; // 绑定, 每种IP协议只能绑定一个, 返回错误信息
+
+    virtual int isBind() = 0; // 0表示无绑定, 1表示只绑定了IPv4, 2表示只绑定了IPv6, 3表示IPv4和IPv6都绑定了
+
+    virtual void send(const QHostAddress &, unsigned short, const QByteArray &, const QByteArray & = {}) = 0; // 按照目的IP的协议选择套接字发送, 数据包为头部 + 用户数据, 支持分散聚集的传输层不需要拼接
+
+    virtual void sendFragmentable(const QHostAddress &, unsigned short, const QByteArray &, const QByteArray & = {}); // 不设置DF发送, 允许IP分片, 没有设置DF时与send相同
+
+    virtual void wake(long long) = 0; // 在指定的单调时钟时间(毫秒)调用poll_, 只需要记住最早的一个
+
+    virtual void notify() = 0; // 可以在任意线程调用, 让传输层所在线程尽快调用poll_
+
+    virtual void setDontFragment(bool) = 0; // 设置DF, 对已经绑定和之后绑定的套接字都有效
+
+    virtual QHostAddress localAddress(QAbstractSocket::NetworkLayerProtocol) = 0; // 本地地址, 用于抓包
+
+    virtual unsigned short localPort(QAbstractSocket::NetworkLayerProtocol) = 0; // 本地端口, 用于抓包
+
+    virtual void close() = 0; // 关闭所有套接字
+
+    virtual long long monotonicUs(); // 单调时钟(微秒), 定时器, RTT和消息延迟都使用它, 默认为steadyUs
+
+    virtual long long wallMs(); // 墙上时钟(毫秒), 用于数据包的发送时间, cookie和票据, 默认为系统时间
+
+    virtual unsigned int random(); // 非安全用途的随机数(连接ID, 心跳抖动, 路径验证), 默认为全局随机数生成器
+
+protected:
+    void deliver_(const QHostAddress &, unsigned short, const QByteArray &); // 把收到的数据包交给CFUPManager
+
+    void poll_(); // 让CFUPManager处理到期的定时器和延迟的窗口更新
+
+private:
+    CFUPManager *cm = nullptr; // 由CFUPManager设置, CFUPManager析构之后为nullptr
+
+    friend class CFUPManager;
+};
@@ -0,0 +1,130 @@
+#include "CFUP.h"
+#include "CFUPManager.h"
+#include "tools/tools.h"
+
+#define THREAD_CHECK(ret) if (!threadCheck_(__FUNCTION__))return ret
+
+CFUPRecvAwaiter CFUP::asyncRecv() {
+    THREAD_CHECK(CFUPRecvAwaiter(nullptr)); // 立即恢复, 结果为空
+    return CFUPRecvAwaiter(this);
+}
+
+CFUPSendAwaiter CFUP::asyncSend(const QByteArray &data, unsigned char priority) {
+    THREAD_CHECK((CFUPSendAwaiter{this, 0})); // 立即恢复, 结果为false
+    if (cs != 1 || data.isEmpty())return {this, 0};
+    send(data, priority);
+    awaited.insert(msgQueued);
+    return {this, msgQueued};
+}
+
+void CFUP::readyRead_() { // 消息先交给等待的协程, 剩余的在本轮事件处理结束时触发一次readyRead
+    while (!recvWaiters.isEmpty() && !readBuf.isEmpty()) {
+        auto w = recvWaiters.takeFirst();
+        w->result = readBuf.takeFirst();
+        cm->resume_(w->handle);
+    }
+    if (readBuf.isEmpty() || readPending)return;
+    readPending = true;
+    cm->postRead_(this);
+}
+
+void CFUP::notifyRead_() {
+    readPending = false;
+    if (!readBuf.isEmpty())emit readyRead(); // 可能已经被asyncRecv取走
+}
+
+void CFUP::acked_(unsigned long long seq) {
+    for (qsizetype i = 0; i < sendWaiters.size(); i++) {
+        auto w = sendWaiters[i];
+        if (w->seq != seq)continue;
+        sendWaiters.removeAt(i);
+        w->result = true;
+        cm->resume_(w->handle);
+        return;
+    }
+}
+
+void CFUP::failWaiters_() { // 连接断开, 恢复所有等待的协程
+    for (auto w: recvWaiters)cm->resume_(w->handle);
+    for (auto w: sendWaiters)cm->resume_(w->handle);
+    recvWaiters.clear();
+    sendWaiters.clear();
+}
+
+CFUPConnectAwaiter CFUPManager::asyncConnect(const QHostAddress &ip, unsigned short port, const QByteArray &data) {
+    return {this, ip, port, data};
+}
+
+void CFUPManager::resume_(std::coroutine_handle<> handle) {
+    ready.append(handle);
+    schedule_(clock_());
+}
+
+void CFUPManager::connectDone_(const QHostAddress &IP, unsigned short port, CFUP *c) {
+    auto key = IPPort(IP, port);
+    if (!connectWaiters.contains(key))return;
+    for (auto w: connectWaiters.take(key)) {
+        w->result = c;
+        resume_(w->handle);
+    }
+}
+
+CFUPConnectAwaiter::CFUPConnectAwaiter(CFUPManager *cm, const QHostAddress &IP, unsigned short port, const QByteArray &data) : cm(cm), IP(IP), port(port), data(data) {}
+
+bool CFUPConnectAwaiter::await_ready() {
+    return false; // 已经连接的情况也由connectToHost处理, 与connected信号的行为一致
+}
+
+bool CFUPConnectAwaiter::await_suspend(std::coroutine_handle<> h) {
+    if (!cm->threadCheck_("asyncConnect"))return false; // connectWaiters只能在管理器所在线程修改, 其他线程的调用不挂起, 结果为nullptr
+    handle = h;
+    auto key = IPPort(IP, port);
+    cm->connectWaiters[key].append(this);
+    cm->connectToHost(IP, port, data);
+    if (!cm->connectWaiters.value(key).contains(this))return true; // 已经有结果, 等待管理器恢复
+    if (cm->connecting.contains(key))return true;
+    cm->connectWaiters[key].removeOne(this); // 没有开始连接(IP不正确), 不挂起
+    if (cm->connectWaiters[key].isEmpty())cm->connectWaiters.remove(key);
+    return false;
+}
+
+CFUP *CFUPConnectAwaiter::await_resume() {
+    return result;
+}
+
+CFUPRecvAwaiter::CFUPRecvAwaiter(CFUP *c) : c(c) {}
+
+bool CFUPRecvAwaiter::await_ready() {
+    if (c == nullptr)return true; // 在其他线程调用被拒绝
+    if (!c->readBuf.isEmpty()) { // 已经有消息, 不挂起
+        result = c->readBuf.takeFirst();
+        return true;
+    }
+    return c->cs == 2;
+}
+
+void CFUPRecvAwaiter::await_suspend(std::coroutine_handle<> h) {
+    handle = h;
+    c->recvWaiters.append(this);
+}
+
+QByteArray CFUPRecvAwaiter::await_resume() {
+    return result;
+}
+
+CFUPSendAwaiter::CFUPSendAwaiter(CFUP *c, unsigned long long seq) : c(c), seq(seq) {}
+
+bool CFUPSendAwaiter::await_ready() {
+    if (seq == 0)return true;
+    result = !c->awaited.contains(seq);
+    return result || c->cs != 1;
+}
+
+void CFUPSendAwaiter::await_suspend(std::coroutine_handle<> h) {
+    handle = h;
+    c->sendWaiters.append(this);
+}
+
+bool CFUPSendAwaiter::await_resume() {
+    return result;
+}
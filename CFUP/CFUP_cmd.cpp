@@ -1,70 +1,139 @@
 #include "CFUP.h"
 #include "CFUPManager.h"
+#include "tools/tools.h"
 
 void CFUP::cmdRC_(const QByteArray &data) { // 已经被CFUPManager过滤过了, 不用二次判断
     if (cs != -1 || initiative)return; // 连接状态: 未连接, 而且不能是主动连接
     long long time = *(long long *) (data.data() + 3);
+    QHash<unsigned char, QByteArray> tlv;
+    if (((data[0] >> 6) & 0x01) && !parseTLV(data.mid(11), tlv))return; // 握手扩展字段不正确
     if (!time_(0, time))return; // 时间不正确
     auto cdpt = newCDPT_(); // 构建回复数据包
     cdpt->SID = 0;
     cdpt->AID = 0;
     cdpt->cf = 0x03;
+    cdpt->data = cm->negotiate_(tlv); // 协商结果
+    QHash<unsigned char, QByteArray> result;
+    parseTLV(cdpt->data, result);
+    apply_(result);
+    if (early)cdpt->data += dumpTLV(TLV_EARLY_ACCEPTED); // 票据已被CFUPManager验证, 告知对方0-RTT数据已接收
+    if (!cdpt->data.isEmpty())cdpt->cf = 0x43;
     sendBufLv1.append(cdpt);
+    nextSID = 1;
     OID = 0;
     cs = 0; // 半连接
+    if (early) { // 0-RTT, 不等待RC ACK的应答直接连接成功
+        cs = 1;
+        sid32 = agreed.SID32; // 握手完成, 切换SID长度
+        cm->cfupConnected_(this);
+        if (cs != 1)return;
+        hbtJitter_();
+        active_();
+        auto userData = tlv.value(TLV_EARLY_DATA);
+        if (!userData.isEmpty())deliver_(userData);
+    }
 }
 
 void CFUP::cmdACK_(bool NA, const QByteArray &data) {
     if (!NA) return;
-    if (data.size() != 3)return;
-    unsigned short AID = (*(unsigned short *) (data.data() + 1));
-    if (cs == 0) { // 如果是半连接状态
-        if (AID == 0 && !initiative) {
-            sendWnd[AID]->stop();
-            // 连接成功
-            cs = 1;
-            cm->cfupConnected_(this);
-            hbt.start(hbtTime);
-        }
-    } else if (sendWnd.contains(AID)) sendWnd[AID]->stop();
+    if (cs == 0 || (sid32 && data.size() == 3)) { // 应答RC ACK始终使用16位AID
+        if (data.size() != 3 || initiative)return;
+        unsigned short AID = (*(unsigned short *) (data.data() + 1));
+        if (AID != 0 || !sendWnd.contains(AID))return;
+        sendWnd[AID]->stop();
+        if (cs == 1)return; // 0-RTT已经连接成功
+        // 连接成功
+        cs = 1;
+        sid32 = agreed.SID32; // 握手完成, 切换SID长度
+        cm->cfupConnected_(this);
+        hbtJitter_();
+        active_();
+        return;
+    }
+    if (data.size() != 1 + sidLen_())return;
+    auto AID = readSID_(data.data() + 1);
+    if (!sendWnd.contains(AID))return;
+    auto cdpt = sendWnd[AID];
+    if (cdpt->isActive() && cdpt->retryNum == 0) { // 重发的数据包无法区分应答的是哪一次发送, 不记录
+        auto rtt = cm->clockUs_() - cdpt->sendTime;
+        stats.rtt.record(rtt);
+        cm->stats.rtt.record(rtt);
+    }
+    cdpt->stop();
 }
 
 void CFUP::cmdRC_ACK_(bool RT, const QByteArray &data) {
-    if (cs == 0 && initiative && data.size() == 13) {
+    if (cs == 0 && initiative && data.size() >= 13) {
         unsigned short SID = *(unsigned short *) (data.data() + 1);
         long long time = *(long long *) (data.data() + 3);
         unsigned short AID = *(unsigned short *) (data.data() + 11);
         if (SID != 0 || AID != 0) return;
+        QHash<unsigned char, QByteArray> tlv;
+        if ((data[0] >> 6) & 0x01) { // 带有握手扩展字段
+            if (!parseTLV(data.mid(13), tlv))return;
+        } else if (data.size() != 13)return;
         if (!time_(SID, time))return;
+        cookie = tlv.value(TLV_COOKIE);
+        apply_(tlv);
         ID = 1;
         OID = 0;
         delete sendWnd[0];
         sendWnd.remove(0);
-        NA_ACK_(0);
+        handshakeACK_();
         // 连接成功
         cs = 1;
+        sid32 = agreed.SID32; // 握手完成, 切换SID长度
+        if (!earlyData.isEmpty() && !tlv.contains(TLV_EARLY_ACCEPTED)) { // 对方没有接收0-RTT数据, 重新发送
+            sendBufLv2[PRIORITY_NORMAL].msgs.append({earlyData, cm->clockUs_(), ++msgQueued});
+        }
+        earlyData.clear();
         cm->cfupConnected_(this);
-        hbt.start(hbtTime);
-    } else if (RT)NA_ACK_(0);
+        hbtJitter_();
+        active_();
+    } else if (RT)handshakeACK_();
 }
 
 void CFUP::cmdC_(bool NA, bool UD, const QByteArray &data) {
     if (!NA) return; // NA必须有
+    if (!cookie.isEmpty() && !UD) { // 无状态握手带回cookie的NA ACK丢失, 对方没有连接对象, 重发而不是断开
+        handshakeACK_();
+        return;
+    }
     QByteArray userData;
     if (UD)userData = data.mid(1);
     close(userData);
 }
 
 void CFUP::cmdH_(bool RT, const QByteArray &data) {
-    if (cs != 1 || data.size() != 11)return;
-    unsigned short SID = (*(unsigned short *) (data.data() + 1));
-    long long time = *(long long *) (data.data() + 3);
+    if (cs != 1 || data.size() != 1 + sidLen_() + 8)return;
+    auto SID = readSID_(data.data() + 1);
+    long long time = *(long long *) (data.data() + 1 + sidLen_());
     if (!time_(SID, time))return;
     NA_ACK_(SID);
-    if (SID == OID + 1) {
-        OID = SID;
-        hbt.stop();
-        hbt.start(hbtTime);
-    } else if (!RT)
-        close("心跳包ID不正确");
+    if (!inRecvWnd_(SID))return; // 已经处理过的重发包, 应答即可
+    if (recvWnd.contains(SID) && !RT)close("心跳包ID不正确");
+    else if (!recvWnd.contains(SID))recvWnd[SID] = {(unsigned char) data[0], SID, {}}; // 心跳包也要占用接收窗口, 保证与数据包的顺序
+}
+
+void CFUP::cmdEX_(const QByteArray &data) { // data[0]为扩展命令类型
+    auto type = (unsigned char) data[0];
+    if (type == EX_FEC)fecRecv_(data);
+    if (type == EX_PROBE && data.size() >= 3) { // 应答探测包的大小, 不需要带回填充
+        CDPT cdpt;
+        cdpt.cf = 0x66;
+        cdpt.data.append((char) EX_PROBE_ACK);
+        cdpt.data += data.mid(1, 2);
+        sendPackage_(&cdpt);
+    }
+    if (type == EX_PROBE_ACK && data.size() == 3)probeACK_(*(unsigned short *) (data.data() + 1));
+    if (!initiative)return; // 其余扩展命令只有被动方下发
+    if (type == EX_TICKET)cm->tickets[IPPort(IP, port)] = data.mid(1); // 保存票据, 下次连接时0-RTT
+    if (type == EX_CID && data.size() == 5)CID = *(unsigned int *) (data.data() + 1); // 之后发送的数据包都携带连接ID
+    if (type == EX_PATH_CHALLENGE && data.size() == 9) { // 原样回复路径验证令牌
+        CDPT cdpt;
+        cdpt.cf = 0x66;
+        cdpt.data.append((char) EX_PATH_RESPONSE);
+        cdpt.data += data.mid(1);
+        sendPackage_(&cdpt);
+    }
 }
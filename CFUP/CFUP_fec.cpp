@@ -0,0 +1,93 @@
+#include "CFUP.h"
+#include "CFUPManager.h"
+#include "tools/tools.h"
+
+// 前向纠错: 每k个连续SID的数据包发送一个异或校验包(EX FEC NA), 组内丢失一个数据包时接收方直接恢复, 不需要等待超时重发
+
+CFUP::FecState *CFUP::fec_() {
+    if (fecState == nullptr)fecState = new FecState;
+    return fecState;
+}
+
+void CFUP::fecAdd_(CDPT *cdpt) {
+    auto cmd = cdpt->cf & 0x07;
+    if ((cmd != 0 && cmd != 7) || !((cdpt->cf >> 6) & 0x01)) { // 命令包打断分组, 交错发送的数据包(cmd 7)与普通数据包一样分组
+        fecFlush_();
+        return;
+    }
+    auto f = fec_();
+    if (f->count != 0 && cdpt->SID != ((f->first + f->count) & sidMask_()))fecFlush_(); // SID不连续
+    if (f->count == 0) { // 新的分组
+        f->k = fecSize;
+        if (f->k == 0) { // 自适应, 丢包率越高分组越小
+            if (lossRate < 0.001)return; // 几乎没有丢包, 不需要校验
+            auto k = 1 / (2 * lossRate);
+            f->k = k < 2 ? 2 : (k > 32 ? 32 : (unsigned char) k);
+        }
+        f->first = cdpt->SID;
+        f->len = 0;
+        f->cf = 0;
+        f->parity.clear();
+    }
+    const auto &data = cdpt->data; // 分片可能引用共享的消息, 不能写
+    if (f->parity.size() < data.size())f->parity.resize(data.size(), 0);
+    for (qsizetype i = 0; i < data.size(); i++)f->parity[i] = (char) (f->parity[i] ^ data[i]);
+    f->len ^= (unsigned short) data.size();
+    f->cf ^= (unsigned char) (cdpt->cf & 0xC7);
+    f->count++;
+    if (f->count >= f->k)fecFlush_();
+}
+
+void CFUP::fecFlush_() {
+    auto f = fecState;
+    if (f == nullptr)return;
+    if (f->count >= 2) { // 只有1个数据包时校验包等于重发, 没有意义
+        CDPT cdpt;
+        cdpt.cf = 0x66; // NA UD EX
+        cdpt.data.append((char) EX_FEC);
+        cdpt.data += dumpSID_(f->first);
+        cdpt.data.append((char) f->count);
+        cdpt.data += dump(f->len);
+        cdpt.data.append((char) f->cf);
+        cdpt.data += f->parity;
+        sendPackage_(&cdpt);
+    }
+    f->count = 0;
+    f->parity.clear();
+}
+
+void CFUP::fecRecv_(const QByteArray &data) { // type(1) + firstSID(2或4) + count(1) + len(2) + cf(1) + parity
+    auto n = sidLen_();
+    if (data.size() < 5 + n)return;
+    fecSeen = true;
+    auto first = readSID_(data.data() + 1);
+    auto count = (unsigned char) data[1 + n];
+    auto len = *(unsigned short *) (data.data() + 2 + n);
+    auto cf = (unsigned char) (data[4 + n] & 0xC7);
+    auto parity = data.mid(5 + n);
+    long long missing = -1;
+    for (unsigned char i = 0; i < count; i++) {
+        auto SID = (first + i) & sidMask_();
+        CFUPDP pkg;
+        if (recvWnd.contains(SID))pkg = recvWnd[SID];
+        else if (fecState != nullptr && fecState->hist.contains(SID))pkg = fecState->hist[SID];
+        else {
+            if (missing != -1)return; // 丢失超过1个, 无法恢复
+            missing = SID;
+            continue;
+        }
+        auto cmd = pkg.cf & 0x07;
+        if ((cmd != 0 && cmd != 7) || pkg.data.size() > parity.size())return; // 与校验包不一致
+        for (qsizetype j = 0; j < pkg.data.size(); j++)parity[j] = (char) (parity[j] ^ pkg.data[j]);
+        len ^= (unsigned short) pkg.data.size();
+        cf ^= (unsigned char) (pkg.cf & 0xC7);
+    }
+    if (missing == -1 || !inRecvWnd_(missing) || len > parity.size())return;
+    auto SID = (unsigned int) missing;
+    recvWnd[SID] = {cf, SID, parity.left(len), true};
+    NA_ACK_(SID); // 应答恢复的数据包, 对方不再重发
+}
+
+void CFUP::fecLoss_(bool lost) { // 指数加权平均, 每次首次发送记0, 每次超时记1
+    lossRate = lossRate * 0.99 + (lost ? 0.01 : 0);
+}
@@ -0,0 +1,80 @@
+#include "CFUP.h"
+#include "CFUPManager.h"
+#include "tools/tools.h"
+
+// 路径MTU探测(PLPMTUD): 套接字设置DF, 发送填充到指定大小的EX PROBE NA, 对方应答说明该大小可以到达, 二分查找最大可用的数据块大小
+
+void CFUP::pmtuStart_() { // 该函数只能被CFUPManager调用
+    pmtuMax = qMin(agreed.dataBlockSize, pmtuCeiling_()); // 不超过协商的数据块大小, 需要更大的数据块时双方都调大CFUPConfig::dataBlockSize
+    pmtuBase = qMin(dataBlockSize, (unsigned short) 1005); // 1005加上头部小于IPv6最小MTU, 认为一定可用
+    pmtuLo = pmtuBase;
+    pmtuHi = pmtuMax;
+    dataBlockSize = pmtuBase;
+    probeSize = 0;
+    pmtuTime = 0; // 等待下一次扫描开始探测, 对方可能还没有完成握手
+}
+
+unsigned short CFUP::pmtuCeiling_() { // 按照携带连接ID的最长头部计算, 略小于实际上限也只是少探测一次
+    auto ip = IP.protocol() == QAbstractSocket::IPv4Protocol ? 28 : 48; // IP和UDP头部
+    return (unsigned short) (cm->pmtuMtu - ip - (1 + 4 + sidLen_() + 8));
+}
+
+void CFUP::pmtud_(long long now) {
+    if (cs != 1 || pmtuBase == 0)return;
+    if (probeSize == 0) {
+        if (now - pmtuTime < pmtuRaise)return;
+        pmtuHi = pmtuMax; // 重新探测更大的数据块
+        pmtuNext_();
+        return;
+    }
+    if (now - probeTime < timeout)return;
+    if (probeCount < 3) { // 探测包也可能是普通丢包, 同一个大小探测3次
+        probe_(probeSize);
+        return;
+    }
+    if (pmtuConfirm) { // 当前数据块大小已经不可用, 从起点重新探测
+        pmtuConfirm = false;
+        pmtuHi = pmtuLo - 1;
+        pmtuLo = pmtuBase;
+        dataBlockSize = pmtuBase;
+    } else pmtuHi = probeSize - 1;
+    pmtuNext_();
+}
+
+void CFUP::pmtuNext_() {
+    probeCount = 0;
+    if (pmtuHi <= pmtuLo || pmtuHi - pmtuLo < 16) { // 精度足够, 探测完成
+        probeSize = 0;
+        pmtuTime = cm->clock_();
+        return;
+    }
+    probe_((pmtuLo + pmtuHi + 1) / 2);
+}
+
+void CFUP::pmtuLoss_(CDPT *cdpt) {
+    if (pmtuBase == 0 || pmtuConfirm || cdpt->data.size() <= pmtuBase)return;
+    pmtuConfirm = true; // 大数据包超时, 可能是路径MTU变小(黑洞), 之后的数据先使用起点大小, 确认当前大小仍然可用再恢复
+    dataBlockSize = pmtuBase;
+    probeCount = 0;
+    probe_(pmtuLo);
+}
+
+void CFUP::probe_(unsigned short size) { // 探测包总长度与数据块大小为size的数据包相同
+    probeSize = size;
+    probeCount++;
+    probeTime = cm->clock_();
+    CDPT cdpt;
+    cdpt.cf = 0x66; // NA UD EX
+    cdpt.data.append((char) EX_PROBE);
+    cdpt.data += dump(size);
+    cdpt.data += QByteArray(size + sidLen_() + 8 - 3, (char) 0x00); // 补齐SID和time的长度
+    sendPackage_(&cdpt);
+}
+
+void CFUP::probeACK_(unsigned short size) {
+    if (probeSize == 0 || size != probeSize)return;
+    if (pmtuConfirm) pmtuConfirm = false; // 当前大小仍然可用, 只是普通丢包
+    else pmtuLo = size;
+    dataBlockSize = pmtuLo;
+    pmtuNext_();
+}
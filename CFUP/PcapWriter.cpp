@@ -0,0 +1,94 @@
+#include "PcapWriter.h"
+#include <QHostAddress>
+#include <QtEndian>
+#include <cstring>
+
+PcapWriter::PcapWriter(const QString &path, long long maxBytes, int maxFiles) : path(path), maxBytes(maxBytes), maxFiles(maxFiles) {
+    if (this->maxBytes < 1024 * 1024)this->maxBytes = 1024 * 1024;
+    if (this->maxFiles < 1)this->maxFiles = 1;
+}
+
+PcapWriter::~PcapWriter() {
+    flush();
+}
+
+QString PcapWriter::open() {
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))return file.errorString();
+    auto h = header_();
+    file.write(h);
+    written = h.size();
+    return {};
+}
+
+void PcapWriter::write(long long us, const QHostAddress &src, unsigned short sport, const QHostAddress &dst, unsigned short dport, const QByteArray &data) {
+    if (!file.isOpen())return;
+    bool ok4 = false, ok6 = false;
+    auto s4 = src.toIPv4Address(&ok4);
+    auto d4 = dst.toIPv4Address(&ok6);
+    bool v4 = ok4 && ok6; // 两端都能转换为IPv4(包括映射到IPv6的IPv4地址)才写IPv4头部, 否则写IPv6头部
+    int ipLen = v4 ? 20 : 40;
+    auto len = (unsigned int) (ipLen + 8 + data.size());
+    char rec[16 + 40 + 8] = {}; // 记录头 + IP头 + UDP头
+    qToLittleEndian((unsigned int) (us / 1000000), rec);
+    qToLittleEndian((unsigned int) (us % 1000000), rec + 4);
+    qToLittleEndian(len, rec + 8);
+    qToLittleEndian(len, rec + 12);
+    auto ip = rec + 16;
+    if (v4) {
+        ip[0] = 0x45;
+        qToBigEndian((unsigned short) len, ip + 2);
+        ip[6] = 0x40; // DF
+        ip[8] = 64; // TTL
+        ip[9] = 17; // UDP
+        qToBigEndian(s4, ip + 12);
+        qToBigEndian(d4, ip + 16);
+        unsigned int sum = 0; // IPv4头部校验和
+        for (int i = 0; i < 20; i += 2)sum += ((unsigned char) ip[i] << 8) | (unsigned char) ip[i + 1];
+        while (sum >> 16)sum = (sum & 0xFFFF) + (sum >> 16);
+        qToBigEndian((unsigned short) ~sum, ip + 10);
+    } else {
+        ip[0] = 0x60;
+        qToBigEndian((unsigned short) (8 + data.size()), ip + 4);
+        ip[6] = 17; // UDP
+        ip[7] = 64; // 跳数限制
+        auto s6 = src.toIPv6Address();
+        auto d6 = dst.toIPv6Address();
+        memcpy(ip + 8, &s6, 16);
+        memcpy(ip + 24, &d6, 16);
+    }
+    auto udp = ip + ipLen; // UDP校验和为0, 表示不校验
+    qToBigEndian(sport, udp);
+    qToBigEndian(dport, udp + 2);
+    qToBigEndian((unsigned short) (8 + data.size()), udp + 4);
+    buf.append(rec, 16 + ipLen + 8);
+    buf += data;
+    if (buf.size() >= 256 * 1024)flush();
+}
+
+void PcapWriter::flush() {
+    if (!file.isOpen() || buf.isEmpty())return;
+    if (written + buf.size() > maxBytes && written > header_().size())rotate_();
+    file.write(buf);
+    file.flush();
+    written += buf.size();
+    buf.clear();
+}
+
+void PcapWriter::rotate_() {
+    file.close();
+    QFile::remove(path + "." + QString::number(maxFiles - 1)); // 删除最旧的文件
+    for (int i = maxFiles - 2; i >= 1; i--)QFile::rename(path + "." + QString::number(i), path + "." + QString::number(i + 1));
+    if (maxFiles > 1)QFile::rename(path, path + "." + QString::number(1));
+    open();
+}
+
+QByteArray PcapWriter::header_() {
+    char h[24] = {};
+    qToLittleEndian((unsigned int) 0xA1B2C3D4, h); // 微秒时间戳
+    qToLittleEndian((unsigned short) 2, h + 4); // 版本2.4
+    qToLittleEndian((unsigned short) 4, h + 6);
+    qToLittleEndian((unsigned int) 65535 + 48, h + 16); // snaplen
+    qToLittleEndian((unsigned int) 101, h + 20); // LINKTYPE_RAW
+    return {h, 24};
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QFile>
+#include <QByteArray>
+
+class QHostAddress;
+
+//pcap格式抓包, 每个数据包合成IP和UDP头部(LINKTYPE_RAW), 先写入内存缓冲, 文件超过上限时轮转
+class PcapWriter final {
+public:
+    explicit PcapWriter(const QString &, long long = 64 * 1024 * 1024, int = 4); // 文件路径, 单个文件大小上限, 保留的文件数量(包含当前文件)
+
+    ~PcapWriter();
+
+    QString open(); // 打开文件并写入文件头, 返回错误信息
+
+    void write(long long, const QHostAddress &, unsigned short, const QHostAddress &, unsigned short, const QByteArray &); // 时间戳(微秒, 由调用方的时钟提供), 源地址, 源端口, 目的地址, 目的端口, UDP数据
+
+    void flush(); // 把缓冲写入文件
+
+private:
+    QString path; // 当前文件路径, 轮转的文件为path.1, path.2 ...
+    long long maxBytes; // 单个文件大小上限
+    int maxFiles; // 保留的文件数量
+    long long written = 0; // 当前文件已经写入的字节数
+    QFile file;
+    QByteArray buf; // 写缓冲
+
+    void rotate_(); // 轮转文件
+
+    static QByteArray header_(); // pcap文件头
+};
@@ -0,0 +1,32 @@
+#include "RateLimiter.h"
+#include <QHash>
+
+RateLimiter::RateLimiter(unsigned short width, unsigned char depth) : width(width), depth(depth) {
+    if (this->depth > 8)this->depth = 8; // 最多8行
+    if (this->width == 0)this->width = 1;
+}
+
+void RateLimiter::setRate(double r, double b) {
+    rate = r;
+    burst = b;
+    buckets.clear(); // 重置所有桶, 下次take时按新的容量分配
+    buckets.squeeze();
+}
+
+bool RateLimiter::take(const QByteArray &key, long long now) {
+    if (rate <= 0)return true;
+    if (buckets.isEmpty())buckets = QList<Bucket>(width * depth, Bucket{(float) burst, 0}); // 第一次取令牌时才分配, 不接受连接的管理器不占内存
+    Bucket *row[8]; // 每行命中的桶
+    float min = (float) burst;
+    for (unsigned char i = 0; i < depth; i++) {
+        auto &bucket = buckets[i * width + qHash(key, i * 0x9E3779B9u + 1) % width];
+        auto tokens = bucket.tokens + (float) ((double) (now - bucket.time) * rate / 1000); // 补充令牌
+        bucket.tokens = tokens < burst ? tokens : (float) burst;
+        bucket.time = now;
+        if (bucket.tokens < min)min = bucket.tokens;
+        row[i] = &bucket;
+    }
+    if (min < 1)return false; // 取所有行的最小值, 哈希冲突只会让估计偏保守
+    for (unsigned char i = 0; i < depth; i++)row[i]->tokens -= 1;
+    return true;
+}
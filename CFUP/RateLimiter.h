@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QList>
+#include <QByteArray>
+
+//count-min草图实现的令牌桶, 内存固定, 不随来源数量增长, 第一次取令牌时才分配
+class RateLimiter final {
+public:
+    explicit RateLimiter(unsigned short = 1024, unsigned char = 4);
+
+    void setRate(double, double); // 设置每秒令牌数和桶容量, 每秒令牌数<=0表示不限制
+
+    bool take(const QByteArray &, long long); // 取一个令牌, 令牌不足返回false
+
+private:
+    class Bucket {
+    public:
+        float tokens = 0; // 剩余令牌
+        long long time = 0; // 上次补充令牌的时间
+    };
+
+    unsigned short width; // 每行桶数量
+    unsigned char depth; // 行数(哈希函数数量)
+    double rate = 0; // 每秒令牌数
+    double burst = 0; // 桶容量
+    QList<Bucket> buckets; // depth * width个桶, 没有取过令牌时为空
+};
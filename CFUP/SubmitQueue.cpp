@@ -0,0 +1,35 @@
+#include "SubmitQueue.h"
+
+SubmitQueue::SubmitQueue() {
+    tail = new Node; // 哨兵
+    head.store(tail, std::memory_order_relaxed);
+}
+
+SubmitQueue::~SubmitQueue() {
+    while (tail != nullptr) {
+        auto next = tail->next.load(std::memory_order_relaxed);
+        delete tail;
+        tail = next;
+    }
+}
+
+bool SubmitQueue::push(Item &&item) {
+    auto node = new Node;
+    node->item = std::move(item);
+    auto prev = head.exchange(node, std::memory_order_acq_rel); // 生产者之间只有这一次交换
+    prev->next.store(node, std::memory_order_release); // 交换之后到这里之前消费者看到的队列是断开的, 由下面的唤醒补上
+    return !pending.exchange(true);
+}
+
+bool SubmitQueue::pop(Item &item) {
+    auto next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr)return false;
+    item = std::move(next->item);
+    delete tail;
+    tail = next; // 取出的节点成为新的哨兵
+    return true;
+}
+
+void SubmitQueue::rearm() {
+    pending.store(false);
+}
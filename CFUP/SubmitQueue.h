@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <QByteArray>
+
+//多生产者单消费者无锁队列(Vyukov), 其他线程提交的send, sendNow和close由管理器所在线程批量取出
+class SubmitQueue final {
+public:
+    enum Op : unsigned char {
+        SEND = 0,
+        SEND_NOW = 1,
+        CLOSE = 2,
+    };
+
+    class Item { // 一次提交
+    public:
+        unsigned long long serial = 0; // CFUP序号
+        Op op = SEND;
+        QByteArray data;
+        unsigned char priority = 0; // send的优先级
+    };
+
+    SubmitQueue();
+
+    ~SubmitQueue();
+
+    bool push(Item &&); // 任意线程调用, 返回true表示需要唤醒消费者(唤醒合并, 同一批只有第一个生产者返回true)
+
+    bool pop(Item &); // 只能由消费者调用, 队列为空返回false
+
+    void rearm(); // 消费者开始取出之前调用, 之后的push会重新请求唤醒
+
+private:
+    class Node {
+    public:
+        std::atomic<Node *> next{nullptr};
+        Item item;
+    };
+
+    std::atomic<Node *> head; // 生产者交换的一端
+    Node *tail; // 消费者持有的一端, 始终指向已经取出的哨兵节点
+    std::atomic<bool> pending{false}; // 已经请求唤醒, 消费者还没有开始取出
+};
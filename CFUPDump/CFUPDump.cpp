@@ -0,0 +1,197 @@
+#include "CFUPDump.h"
+#include <QFile>
+#include <QHostAddress>
+#include <QtEndian>
+#include <algorithm>
+#include "tools/tools.h"
+
+CFUPDump::CFUPDump(QTextStream &out) : out(out) {}
+
+void CFUPDump::setPort(unsigned short p) {
+    port = p;
+}
+
+void CFUPDump::setVerbose(bool v) {
+    verbose = v;
+}
+
+void CFUPDump::setInterval(long long i) {
+    interval = i < 1 ? 1 : i;
+}
+
+QString CFUPDump::load(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))return path + ": " + file.errorString();
+    auto h = file.read(24);
+    if (h.size() != 24)return path + ": 文件头不完整";
+    auto magic = qFromLittleEndian<unsigned int>(h.data());
+    bool swap = (magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1); // 大端序写入的文件
+    if (swap)magic = qFromBigEndian<unsigned int>(h.data());
+    if (magic != 0xA1B2C3D4 && magic != 0xA1B23C4D)return path + ": 不是pcap文件(pcapng请先用editcap -F pcap转换)";
+    bool nano = magic == 0xA1B23C4D;
+    auto u32 = [swap](const char *p) { return swap ? qFromBigEndian<unsigned int>(p) : qFromLittleEndian<unsigned int>(p); };
+    auto link = u32(h.data() + 20) & 0xFFFF;
+    while (!file.atEnd()) {
+        auto rec = file.read(16);
+        if (rec.size() != 16)break;
+        long long time = (long long) u32(rec.data()) * 1000000 + (nano ? u32(rec.data() + 4) / 1000 : u32(rec.data() + 4));
+        auto pkt = file.read(u32(rec.data() + 8));
+        int off; // IP头部的位置
+        if (link == 101 || link == 228 || link == 229)off = 0; // RAW
+        else if (link == 0)off = 4; // BSD loopback
+        else if (link == 1)off = 14; // Ethernet
+        else if (link == 113)off = 16; // Linux cooked
+        else if (link == 276)off = 20; // Linux cooked v2
+        else return path + ": 不支持的链路类型" + QString::number(link);
+        if (link == 1 && pkt.size() >= 18 && qFromBigEndian<unsigned short>(pkt.data() + 12) == 0x8100)off += 4; // VLAN
+        if (pkt.size() < off + 20)continue;
+        auto ip = pkt.data() + off;
+        QHostAddress src, dst;
+        int udpOff;
+        if ((ip[0] >> 4) == 4) {
+            if (ip[9] != 17)continue;
+            udpOff = off + (ip[0] & 0x0F) * 4;
+            src.setAddress(qFromBigEndian<unsigned int>(ip + 12));
+            dst.setAddress(qFromBigEndian<unsigned int>(ip + 16));
+        } else if ((ip[0] >> 4) == 6) {
+            if (pkt.size() < off + 40 || ip[6] != 17)continue; // 不处理IPv6扩展头部
+            udpOff = off + 40;
+            src.setAddress((const quint8 *) ip + 8);
+            dst.setAddress((const quint8 *) ip + 24);
+        } else continue;
+        if (pkt.size() < udpOff + 8)continue;
+        auto sport = qFromBigEndian<unsigned short>(pkt.data() + udpOff);
+        auto dport = qFromBigEndian<unsigned short>(pkt.data() + udpOff + 2);
+        if (port != 0 && sport != port && dport != port)continue;
+        auto data = pkt.mid(udpOff + 8);
+        if (!data.isEmpty())packet_(time, IPPort(src, sport), IPPort(dst, dport), data);
+    }
+    return {};
+}
+
+void CFUPDump::packet_(long long time, const QString &src, const QString &dst, const QByteArray &d) {
+    auto key = src < dst ? src + " " + dst : dst + " " + src;
+    if (!conns.contains(key)) {
+        auto &c = conns[key];
+        c.name[0] = src;
+        c.name[1] = dst;
+        c.start = time;
+        order.append(key);
+    }
+    auto &c = conns[key];
+    int s = c.name[0] == src ? 0 : 1;
+    auto &side = c.side[s];
+    auto &peer = c.side[1 - s];
+    side.packets++;
+    side.bytes += d.size();
+
+    auto cf = (unsigned char) d[0];
+    qsizetype off = 1;
+    if ((cf >> 3) & 0x01)off += 4; // 连接ID
+    bool UDL = (cf >> 7) & 0x01, UD = (cf >> 6) & 0x01, NA = (cf >> 5) & 0x01, RT = (cf >> 4) & 0x01;
+    auto cmd = cf & 0x07;
+    bool handshakeACK = cmd == 2 && (UD || (c.sid32 && d.size() - off == 2)); // 应答RC ACK始终使用16位AID, 只有32位SID时可以按长度区分
+    int n = (c.sid32 && cmd != 1 && cmd != 3 && !handshakeACK) ? 4 : 2; // SID字节数
+    auto readSID = [&](qsizetype p) { return n == 4 ? qFromLittleEndian<unsigned int>(d.data() + p) : qFromLittleEndian<unsigned short>(d.data() + p); };
+    auto mask = n == 4 ? 0xFFFFFFFFu : 0xFFFFu;
+    bool hasSID = !NA, hasAID = cmd == 2 || cmd == 3;
+    if (d.size() < off + (hasSID ? n + 8 : 0) + (hasAID ? n : 0))return; // 长度不正确
+    unsigned int SID = 0, AID = 0;
+    long long sendTime = 0;
+    if (hasSID) {
+        SID = readSID(off);
+        sendTime = qFromLittleEndian<long long>(d.data() + off + n);
+        off += n + 8;
+    }
+    if (hasAID) {
+        AID = readSID(off);
+        off += n;
+    }
+    if (cmd == 2 && NA && AID == 0 && peer.rcAck)handshakeACK = true; // 16位SID时长度相同, 按对方发送过的RC ACK区分
+    if (handshakeACK)peer.rcAck = false;
+    if (cmd == 3)side.rcAck = true;
+    auto data = UD ? d.mid(off) : QByteArray();
+    auto &slot = side.timeline[(time - c.start) / 1000000 / interval];
+
+    if (verbose) {
+        static const char *cmds[] = {"", "RC", "ACK", "RC ACK", "C", "H", "EX", "CH"};
+        QString flags;
+        if (UDL)flags += "UDL ";
+        if (UD)flags += "UD ";
+        if (NA)flags += "NA ";
+        if (RT)flags += "RT ";
+        if ((cf >> 3) & 0x01)flags += "CID ";
+        out << QString::number((double) time / 1000000, 'f', 6) << " " << src << " -> " << dst << " " << flags << cmds[cmd];
+        if (hasSID)out << " SID=" << SID << " time=" << sendTime;
+        if (hasAID)out << " AID=" << AID;
+        if (UD)out << " len=" << data.size();
+        out << "\n";
+    }
+
+    if (cmd == 3 && UD) { // 握手扩展字段中的连接参数, 协商了32位SID时连接成功之后切换
+        QHash<unsigned char, QByteArray> tlv;
+        if (parseTLV(data, tlv) && tlv.value(0x06).size() >= 9 && (tlv.value(0x06)[8] & 0x01))c.sid32 = true;
+    }
+    if (cmd == 2 && NA && !handshakeACK) { // 应答对方的数据包
+        if (peer.sendTime.contains(AID)) {
+            auto rtt = time - peer.sendTime.take(AID);
+            peer.rtt.record(rtt);
+            auto &peerSlot = peer.timeline[(time - c.start) / 1000000 / interval];
+            peerSlot.rttSum += rtt;
+            peerSlot.rttCount++;
+        }
+        return;
+    }
+    if (!hasSID || cmd == 1 || cmd == 3)return; // 只统计连接之后的可靠数据包
+    side.reliable++;
+    if (RT) {
+        side.retransmits++;
+        slot.retransmits++;
+        side.sendTime.remove(SID); // 重发之后无法区分应答的是哪一次发送
+    } else {
+        if (side.hasMax && ((SID - side.maxSID) & mask) > mask / 2)side.reordered++; // 比已经出现过的SID更早
+        else {
+            side.maxSID = SID;
+            side.hasMax = true;
+        }
+        side.sendTime[SID] = time;
+    }
+    if ((cmd == 0 || cmd == 7) && UD && !side.seen.contains(SID)) { // cmd 7是交错发送的数据包, 第一个字节是通道号
+        auto size = data.size() - (cmd == 7 ? 1 : 0);
+        side.seen.insert(SID);
+        side.goodput += size;
+        slot.goodput += size;
+    }
+}
+
+void CFUPDump::report() {
+    for (const auto &key: order) {
+        const auto &c = conns[key];
+        out << "连接 " << c.name[0] << " <-> " << c.name[1] << (c.sid32 ? " (32位SID)" : "") << "\n";
+        for (int s = 0; s < 2; s++) {
+            const auto &i = c.side[s];
+            auto rate = i.reliable == 0 ? 0.0 : (double) i.retransmits * 100 / (double) i.reliable;
+            out << "  " << c.name[s] << " -> " << c.name[1 - s]
+                << ": 数据包" << i.packets << " 字节" << i.bytes << " 可靠" << i.reliable
+                << " 重发" << i.retransmits << "(" << QString::number(rate, 'f', 2) << "%)"
+                << " 乱序" << i.reordered << " 有效数据" << i.goodput << "字节\n";
+            out << "    RTT: " << histogramToString(i.rtt) << "\n";
+        }
+        QSet<long long> keySet; // 两个方向的时间线合并
+        for (const auto &i: c.side)for (auto j = i.timeline.begin(); j != i.timeline.end(); ++j)keySet.insert(j.key());
+        auto keys = keySet.values();
+        std::sort(keys.begin(), keys.end());
+        out << "  时间线(每" << interval << "秒, 吞吐KB/s 重发 RTT均值ms):\n";
+        for (auto k: keys) {
+            out << "    " << QString::number(k * interval).rightJustified(6);
+            for (int s = 0; s < 2; s++) {
+                auto slot = c.side[s].timeline.value(k);
+                auto rtt = slot.rttCount == 0 ? QString("-") : QString::number((double) slot.rttSum / (double) slot.rttCount / 1000, 'f', 3);
+                out << " | " << (s == 0 ? "→ " : "← ")
+                    << QString::number((double) slot.goodput / 1024 / (double) interval, 'f', 1).rightJustified(10)
+                    << QString::number(slot.retransmits).rightJustified(6) << rtt.rightJustified(10);
+            }
+            out << "\n";
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QStringList>
+#include <QTextStream>
+#include "CFUP/CFUPStats.h"
+
+//离线解析pcap抓包, 按照protocol.md解码CFUP数据包, 统计每个连接的RTT, 重发, 乱序和有效吞吐
+class CFUPDump final {
+public:
+    explicit CFUPDump(QTextStream &);
+
+    void setPort(unsigned short); // 只解析该端口的UDP数据包, 0表示不过滤
+
+    void setVerbose(bool); // 逐包输出解码结果
+
+    void setInterval(long long); // 时间线间隔(秒)
+
+    QString load(const QString &); // 解析一个pcap文件, 返回错误信息, 可以依次加载轮转的多个文件
+
+    void report(); // 输出每个连接的统计和时间线
+
+private:
+    class Slot { // 时间线上的一个间隔
+    public:
+        unsigned long long goodput = 0; // 有效数据字节数(不含重发)
+        unsigned long long retransmits = 0;
+        long long rttSum = 0;
+        unsigned long long rttCount = 0;
+    };
+
+    class Side { // 一个方向, 以发送方区分
+    public:
+        unsigned long long packets = 0; // 数据包
+        unsigned long long bytes = 0; // UDP数据字节数
+        unsigned long long reliable = 0; // 需要应答的数据包
+        unsigned long long retransmits = 0; // 重发包
+        unsigned long long reordered = 0; // SID小于已经出现过的最大SID
+        unsigned long long goodput = 0; // 有效数据字节数
+        bool hasMax = false;
+        unsigned int maxSID = 0; // 已经出现过的最大SID
+        bool rcAck = false; // 发送了RC ACK, 还没有收到对方应答RC ACK的NA ACK
+        QHash<unsigned int, long long> sendTime; // 首次发送且没有重发的SID, 用于计算RTT
+        QSet<unsigned int> seen; // 已经出现过的用户数据SID
+        CFUPHistogram rtt; // 该方向数据包的RTT(微秒)
+        QMap<long long, Slot> timeline;
+    };
+
+    class Conn {
+    public:
+        QString name[2]; // 首先发送数据包的一端(通常是RC的发送方)为0
+        bool sid32 = false; // RC ACK协商了32位SID
+        long long start = 0; // 第一个数据包的时间(微秒)
+        Side side[2];
+    };
+
+    QTextStream &out;
+    unsigned short port = 0;
+    bool verbose = false;
+    long long interval = 1;
+    QHash<QString, Conn> conns; // 按照两端地址排序之后的字符串索引
+    QStringList order; // 连接出现的顺序
+
+    void packet_(long long, const QString &, const QString &, const QByteArray &); // 时间(微秒), 源地址, 目的地址, UDP数据
+};
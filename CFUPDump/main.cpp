@@ -0,0 +1,34 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include "CFUPDump.h"
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("CFUPDump");
+    QCommandLineParser parser;
+    parser.setApplicationDescription("解析CFUP抓包(pcap), 输出每个连接的RTT, 重发, 乱序和有效吞吐");
+    parser.addHelpOption();
+    QCommandLineOption portOption({"p", "port"}, "只解析该UDP端口", "port", "0");
+    QCommandLineOption intervalOption({"i", "interval"}, "时间线间隔(秒)", "seconds", "1");
+    QCommandLineOption verboseOption({"v", "verbose"}, "逐包输出解码结果");
+    parser.addOption(portOption);
+    parser.addOption(intervalOption);
+    parser.addOption(verboseOption);
+    parser.addPositionalArgument("files", "pcap文件, 轮转的文件按时间顺序依次给出");
+    parser.process(a);
+    if (parser.positionalArguments().isEmpty())parser.showHelp(1);
+    QTextStream out(stdout);
+    CFUPDump dump(out);
+    dump.setPort(parser.value(portOption).toUShort());
+    dump.setInterval(parser.value(intervalOption).toLongLong());
+    dump.setVerbose(parser.isSet(verboseOption));
+    for (const auto &i: parser.positionalArguments()) {
+        auto error = dump.load(i);
+        if (!error.isEmpty()) {
+            out << error << "\n";
+            return 1;
+        }
+    }
+    dump.report();
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "CFUPBench.h"
+#include <QCoreApplication>
+#include <QEvent>
+#include <QEventLoop>
+#include <QSemaphore>
+#include <QThread>
+#include "tools/tools.h"
+
+#ifdef Q_OS_LINUX
+#include "CFUP/CFUPEpollTransport.h"
+#endif
+
+CFUPBench::CFUPBench(QTextStream &out) : out(out) {}
+
+void CFUPBench::setEpoll(bool e) {
+    epoll = e;
+}
+
+void CFUPBench::setPort(unsigned short p) {
+    port = p;
+}
+
+void CFUPBench::setMessageSize(int s) {
+    payload = QByteArray(s < 1 ? 1 : s, 'x');
+}
+
+void CFUPBench::setPipeline(int p) {
+    pipeline = p < 1 ? 1 : p;
+}
+
+void CFUPBench::setDuration(long long d) {
+    duration = d < 1 ? 1 : d;
+}
+
+CFUPBench::Loop CFUPBench::open_() {
+    Loop l;
+#ifdef Q_OS_LINUX
+    if (epoll) {
+        l.t = new CFUPEpollTransport;
+        l.m = new CFUPManager(l.t);
+        return l;
+    }
+#endif
+    l.loop = new QEventLoop;
+    l.m = new CFUPManager;
+    return l;
+}
+
+void CFUPBench::exec_(const Loop &l) {
+#ifdef Q_OS_LINUX
+    if (l.t != nullptr) {
+        l.t->run();
+        return;
+    }
+#endif
+    l.loop->exec();
+}
+
+void CFUPBench::stop_(const Loop &l) {
+#ifdef Q_OS_LINUX
+    if (l.t != nullptr) {
+        l.t->stop();
+        return;
+    }
+#endif
+    QMetaObject::invokeMethod(l.loop, &QEventLoop::quit, Qt::QueuedConnection); // 可以在其他线程调用
+}
+
+void CFUPBench::close_(const Loop &l) {
+    l.m->close();
+#ifdef Q_OS_LINUX
+    if (l.t != nullptr) {
+        l.t->runOnce(0); // 让等待中的协程收到断开的结果
+        l.m->quit();
+        l.t->runOnce(0); // runOnce最后删除deleteLater的对象
+        delete l.t;
+        return;
+    }
+#endif
+    QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
+    l.m->quit();
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+    delete l.loop;
+}
+
+CFUPTask CFUPBench::client_(Loop l) {
+    auto c = co_await l.m->asyncConnect(QHostAddress(QHostAddress::LocalHost), port);
+    if (c == nullptr) {
+        error = "连接失败";
+        stop_(l);
+        co_return;
+    }
+    begin = l.m->getStats();
+    beginCpu = cpuUs();
+    beginTime = steadyUs();
+    deadline = beginTime + duration * 1000;
+    pumps = pipeline;
+    for (int i = 0; i < pipeline; i++)pump_(c, l);
+}
+
+CFUPTask CFUPBench::pump_(CFUP *c, Loop l) {
+    while (steadyUs() < deadline && co_await c->asyncSend(payload))messages++;
+    if (--pumps > 0)co_return;
+    endCpu = cpuUs();
+    endTime = steadyUs();
+    end = l.m->getStats();
+    c->close(); // 服务端收到断开之后结束
+    stop_(l);
+}
+
+QString CFUPBench::run() {
+    QSemaphore ready; // 服务端绑定之后客户端再连接
+    QString serverError;
+    Loop serverLoop;
+    auto server = QThread::create([this, &ready, &serverError, &serverLoop]() { // 管理器和传输层都在服务端线程创建和删除
+        auto l = serverLoop = open_();
+        serverError = l.m->bind("127.0.0.1", port);
+        QObject::connect(l.m, &CFUPManager::connected, l.m, [this, l](CFUP *c) {
+            c->setReadHandler([this](QByteArrayView data) { recvBytes += data.size(); });
+            QObject::connect(c, &CFUP::disconnected, c, [this, l]() { stop_(l); });
+        });
+        ready.release();
+        if (serverError.isEmpty())exec_(l);
+        close_(l);
+    });
+    server->start();
+    ready.acquire();
+    if (!serverError.isEmpty()) {
+        server->wait();
+        delete server;
+        return serverError;
+    }
+    auto l = open_();
+    l.m->bind("127.0.0.1", 0);
+    client_(l);
+    exec_(l);
+    close_(l);
+    if (!error.isEmpty())stop_(serverLoop); // 服务端没有收到连接, 需要单独停止
+    server->wait();
+    delete server;
+    if (!error.isEmpty())return error;
+    auto seconds = (double) (endTime - beginTime) / 1000000;
+    auto packets = end.packetsSent + end.packetsRecv - begin.packetsSent - begin.packetsRecv;
+    auto cpu = endCpu - beginCpu;
+    out << "传输层: " << (epoll ? "epoll(run驱动)" : "Qt(QEventLoop驱动)") << " 消息" << payload.size() << "字节 并发" << pipeline << "\n";
+    out << "  消息: " << messages << "(" << QString::number((double) messages / seconds, 'f', 1) << "/s) 服务端收到"
+        << QString::number((double) recvBytes / 1048576 / seconds, 'f', 2) << "MB/s\n";
+    out << "  数据包: " << packets << "(" << QString::number((double) packets / seconds, 'f', 1) << "/s) CPU" << cpu / 1000 << "ms "
+        << QString::number((double) cpu / seconds / 10000, 'f', 1) << "%\n";
+    out << "  每个数据包: " << QString::number(packets == 0 ? 0.0 : (double) cpu / (double) packets, 'f', 3) << "us(两端的发送和接收合计)\n";
+    return {};
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QTextStream>
+#include "CFUP/CFUPAwait.h"
+#include "CFUP/CFUPManager.h"
+
+class QEventLoop;
+class CFUPEpollTransport;
+
+//传输层对比: 服务端在单独的线程, 客户端在主线程, 一个连接按窗口饱和发送固定时长
+//Qt传输层由QEventLoop驱动, epoll传输层由run驱动(不经过Qt事件循环), 进程CPU时间除以客户端收发的数据包数量得到每个数据包两端合计的CPU开销
+class CFUPBench final {
+public:
+    explicit CFUPBench(QTextStream &);
+
+    void setEpoll(bool); // 使用epoll传输层(仅Linux)
+
+    void setPort(unsigned short); // 服务端端口, 只绑定127.0.0.1
+
+    void setMessageSize(int); // 消息大小
+
+    void setPipeline(int); // 同时等待应答的消息数量
+
+    void setDuration(long long); // 发送时长(毫秒)
+
+    QString run(); // 运行并输出结果, 返回错误信息
+
+private:
+    class Loop { // 一个线程的管理器和驱动它的事件循环
+    public:
+        CFUPManager *m = nullptr;
+        CFUPEpollTransport *t = nullptr; // epoll传输层, 使用Qt传输层时为nullptr
+        QEventLoop *loop = nullptr; // Qt传输层的事件循环
+    };
+
+    QTextStream &out;
+    bool epoll = false;
+    unsigned short port = 9000;
+    int pipeline = 4;
+    long long duration = 10000;
+    QByteArray payload = QByteArray(1000, 'x');
+    QString error; // 客户端的错误信息
+    int pumps = 0; // 还在发送的协程数量
+    long long deadline = 0; // 停止发送的时间(微秒)
+    unsigned long long messages = 0; // 全部应答的消息
+    unsigned long long recvBytes = 0; // 服务端收到的消息字节数, 只在服务端线程更新, 结束之后读取
+    CFUPManagerStats begin; // 开始发送时客户端管理器的统计
+    CFUPManagerStats end; // 停止发送时客户端管理器的统计
+    long long beginCpu = 0; // 进程CPU时间(微秒)
+    long long endCpu = 0;
+    long long beginTime = 0; // 单调时钟(微秒)
+    long long endTime = 0;
+
+    Loop open_(); // 在当前线程创建传输层和管理器
+
+    void exec_(const Loop &); // 运行事件循环, 直到stop_
+
+    void stop_(const Loop &); // 可以在其他线程调用
+
+    void close_(const Loop &); // 关闭并删除管理器和传输层, 让等待中的协程先结束
+
+    CFUPTask client_(Loop); // 连接服务端, 成功后启动pipeline个发送协程
+
+    CFUPTask pump_(CFUP *, Loop); // 发送到截止时间, 最后一个结束的协程记录统计并断开
+};
@@ -0,0 +1,316 @@
+#include "CFUPLoad.h"
+#include <QCoreApplication>
+#include <QEvent>
+#include <QSocketNotifier>
+#include <cmath>
+#include "tools/tools.h"
+
+#ifdef Q_OS_LINUX
+#include "CFUP/CFUPEpollTransport.h"
+#endif
+
+CFUPLoad::CFUPLoad(QTextStream &out) : out(out) {
+    baseRss = rssBytes();
+    sendTimer.setTimerType(Qt::PreciseTimer);
+    sendTimer.setInterval(5);
+    QObject::connect(&sendTimer, &QTimer::timeout, &sendTimer, [this]() { tick_(); });
+    QObject::connect(&churnTimer, &QTimer::timeout, &churnTimer, [this]() { churn_(); });
+    QObject::connect(&reportTimer, &QTimer::timeout, &reportTimer, [this]() { report(false); });
+}
+
+CFUPLoad::~CFUPLoad() {
+    running = false;
+    sendTimer.stop();
+    churnTimer.stop();
+    reportTimer.stop();
+    for (auto m: clients)m->close();
+    for (auto m: servers)m->close();
+    QCoreApplication::processEvents(QEventLoop::AllEvents, 100); // 让等待中的协程收到断开的结果
+    for (auto m: clients)m->quit();
+    for (auto m: servers)m->quit();
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+    qDeleteAll(notifiers);
+    qDeleteAll(transports);
+    qDeleteAll(slotList);
+}
+
+void CFUPLoad::setEpoll(bool e) {
+    epoll = e;
+}
+
+void CFUPLoad::setPorts(unsigned short base, int count) {
+    basePort = base;
+    ports = qBound(1, count, 65536 - base);
+}
+
+void CFUPLoad::setConnections(int n) {
+    connections = n < 1 ? 1 : n;
+}
+
+void CFUPLoad::setMaxConnections(int n) {
+    maxConnections = n < 1 ? 1 : n;
+}
+
+void CFUPLoad::setMessageSize(int min, int max) {
+    minSize = min < 1 ? 1 : min;
+    maxSize = max < minSize ? minSize : max;
+}
+
+void CFUPLoad::setRate(double r, bool p) {
+    rate = r < 0 ? 0 : r;
+    poisson = p;
+}
+
+void CFUPLoad::setPipeline(int p) {
+    pipeline = p < 1 ? 1 : p;
+}
+
+void CFUPLoad::setChurn(double percent, long long i) {
+    churn = qBound(0.0, percent, 100.0);
+    churnInterval = i < 1 ? 1 : i;
+}
+
+void CFUPLoad::setInterval(long long i) {
+    interval = i < 1 ? 1 : i;
+}
+
+void CFUPLoad::setSeed(unsigned int seed) {
+    rng.seed(seed);
+}
+
+CFUPManager *CFUPLoad::newManager_() {
+#ifdef Q_OS_LINUX
+    if (epoll) {
+        auto t = new CFUPEpollTransport;
+        transports.append(t);
+        auto n = new QSocketNotifier(t->fd(), QSocketNotifier::Read);
+        QObject::connect(n, &QSocketNotifier::activated, n, [t]() { t->runOnce(0); });
+        notifiers.append(n);
+        return new CFUPManager(t);
+    }
+#endif
+    return new CFUPManager;
+}
+
+void CFUPLoad::begin_() {
+    if (begun)return;
+    begun = true;
+    first = last = collect_();
+    reportTimer.start((int) interval);
+    out << "      时间s   客户端   服务端 新连接 失败 断开 |  发送/s  应答/s  应答KB/s  收到/s  收到KB/s 重发% | 握手p50/p99ms  延迟p50/p99ms | RSS MB 每连接B   CPU% 每消息us\n";
+    out.flush();
+}
+
+QString CFUPLoad::startServer(const QHostAddress &IP) {
+    for (int i = 0; i < ports; i++) {
+        auto m = newManager_();
+        servers.append(m);
+        m->setMaxConnectNum(maxConnections);
+        auto error = m->bind(IP.toString(), basePort + i);
+        if (!error.isEmpty())return "端口" + QString::number(basePort + i) + ": " + error;
+        QObject::connect(m, &CFUPManager::connected, m, [this](CFUP *c) {
+            c->setReadHandler([this](QByteArrayView data) { // 只计数, 不需要进入可读缓存
+                total.recvMessages++;
+                total.recvBytes += data.size();
+            });
+        });
+    }
+    begin_();
+    return {};
+}
+
+QString CFUPLoad::startClient(const QHostAddress &IP) {
+    serverIP = IP;
+    payload = QByteArray(maxSize, 'x');
+    auto any = IP.protocol() == QAbstractSocket::IPv6Protocol ? QString("::") : QString("0.0.0.0");
+    auto now = steadyUs();
+    while (slotList.size() < connections) { // 每个管理器连接所有端口, 一个管理器对同一个地址只能有一个连接
+        auto m = newManager_();
+        clients.append(m);
+        auto error = m->bind(any, 0);
+        if (!error.isEmpty())return "客户端" + QString::number(clients.size()) + ": " + error;
+        QObject::connect(m, &CFUPManager::connected, m, [this, m](CFUP *c) {
+            auto s = slotIndex.value({m, c->getPort()}, nullptr);
+            if (s != nullptr)connected_(s, c);
+        });
+        QObject::connect(m, &CFUPManager::connectFail, m, [this, m](const QHostAddress &, unsigned short port, const QByteArray &) {
+            auto s = slotIndex.value({m, port}, nullptr);
+            if (s == nullptr)return;
+            s->connectStart = 0;
+            total.failed++;
+            if (running)QTimer::singleShot(1000, &sendTimer, [this, s]() { connect_(s); }); // 服务端不可用时不要连续重试
+        });
+        for (int i = 0; i < ports && slotList.size() < connections; i++) {
+            auto s = new Slot;
+            s->m = m;
+            s->port = basePort + i;
+            slotList.append(s);
+            slotIndex[{m, s->port}] = s;
+            if (rate > 0)schedule.insert(now + (long long) rng.bounded(1000000.0 / rate), s); // 随机相位, 避免所有连接同时发送
+            connect_(s);
+        }
+    }
+    if (rate > 0)sendTimer.start();
+    if (churn > 0)churnTimer.start((int) churnInterval);
+    begin_();
+    return {};
+}
+
+QByteArray CFUPLoad::message_() {
+    auto size = minSize + (int) rng.bounded(maxSize - minSize + 1);
+    return QByteArray::fromRawData(payload.constData(), size);
+}
+
+long long CFUPLoad::gap_() {
+    auto mean = 1000000.0 / rate;
+    if (!poisson)return (long long) mean;
+    return (long long) (-std::log(1 - rng.generateDouble()) * mean); // 指数分布的间隔
+}
+
+void CFUPLoad::connect_(Slot *s) {
+    if (!running || s->c != nullptr)return;
+    s->connectStart = steadyUs();
+    s->m->connectToHost(serverIP, s->port);
+}
+
+void CFUPLoad::connected_(Slot *s, CFUP *c) {
+    if (s->connectStart != 0) {
+        auto t = steadyUs() - s->connectStart;
+        handshake.record(t);
+        handshakeTotal.record(t);
+        s->connectStart = 0;
+    }
+    s->c = c;
+    total.handshakes++;
+    QObject::connect(c, &CFUP::disconnected, c, [this, s]() { disconnected_(s); });
+    if (rate == 0)for (int i = 0; i < pipeline; i++)pump_(c);
+}
+
+void CFUPLoad::disconnected_(Slot *s) {
+    if (s->c == nullptr)return;
+    auto stats = s->c->getStats(); // 断开之后CFUP会被删除, 计数累计到total
+    total.packets += stats.packetsSent;
+    total.retransmits += stats.retransmits;
+    total.disconnects++;
+    s->c = nullptr;
+    if (running)QTimer::singleShot(0, &sendTimer, [this, s]() { connect_(s); }); // 不在disconnected信号中重连
+}
+
+void CFUPLoad::tick_() {
+    auto now = steadyUs();
+    while (!schedule.isEmpty() && schedule.firstKey() <= now) {
+        auto time = schedule.firstKey();
+        auto s = schedule.take(time);
+        if (s->c != nullptr)send_(s->c, message_());
+        auto next = time + gap_();
+        if (next < now - 1000000)next = now; // 落后太多(进程被挂起等), 不补发
+        schedule.insert(next, s);
+    }
+}
+
+void CFUPLoad::churn_() {
+    QList<Slot *> live;
+    for (auto s: slotList)if (s->c != nullptr)live.append(s);
+    auto n = (qsizetype) std::lround((double) live.size() * churn / 100);
+    for (qsizetype i = 0; i < n; i++) { // 部分洗牌, 随机选出n个
+        auto j = i + (qsizetype) rng.bounded((quint64) (live.size() - i));
+        std::swap(live[i], live[j]);
+        live[i]->c->close();
+    }
+}
+
+CFUPTask CFUPLoad::send_(CFUP *c, QByteArray data) {
+    auto t = steadyUs();
+    total.sentMessages++;
+    total.sentBytes += data.size();
+    if (!co_await c->asyncSend(data))co_return; // 连接已经断开, CFUPLoad可能已经析构
+    auto l = steadyUs() - t;
+    latency.record(l);
+    latencyTotal.record(l);
+    total.acked++;
+    total.ackedBytes += data.size();
+}
+
+CFUPTask CFUPLoad::pump_(CFUP *c) {
+    while (running) {
+        auto data = message_();
+        auto t = steadyUs();
+        total.sentMessages++;
+        total.sentBytes += data.size();
+        if (!co_await c->asyncSend(data))co_return;
+        auto l = steadyUs() - t;
+        latency.record(l);
+        latencyTotal.record(l);
+        total.acked++;
+        total.ackedBytes += data.size();
+    }
+}
+
+CFUPLoad::Counter CFUPLoad::collect_() {
+    auto c = total;
+    for (auto s: slotList) {
+        if (s->c == nullptr)continue;
+        auto stats = s->c->getStats();
+        c.packets += stats.packetsSent;
+        c.retransmits += stats.retransmits;
+    }
+    c.cpu = cpuUs();
+    c.time = steadyUs();
+    return c;
+}
+
+void CFUPLoad::report(bool summary) {
+    auto now = collect_();
+    const auto &prev = summary ? first : last;
+    auto span = (double) (now.time - prev.time) / 1000000;
+    if (span <= 0)span = 1;
+    qsizetype clientNum = 0, serverNum = 0;
+    for (auto s: slotList)if (s->c != nullptr)clientNum++;
+    for (auto m: servers)serverNum += m->getConnectedNum();
+    auto rss = rssBytes();
+    auto perConn = clientNum + serverNum == 0 ? 0 : (rss - baseRss) / (clientNum + serverNum);
+    auto messages = (now.acked - prev.acked) + (now.recvMessages - prev.recvMessages);
+    auto cpu = now.cpu - prev.cpu;
+    auto packets = now.packets - prev.packets;
+    auto retrans = packets == 0 ? 0.0 : (double) (now.retransmits - prev.retransmits) * 100 / (double) packets;
+    auto perMessage = messages == 0 ? QString("-") : QString::number((double) cpu / (double) messages, 'f', 2);
+    auto ms = [](const CFUPHistogram &h, double p) {
+        return h.getCount() == 0 ? QString("-") : QString::number((double) h.percentile(p) / 1000, 'f', 1);
+    };
+    const auto &hs = summary ? handshakeTotal : handshake;
+    const auto &lat = summary ? latencyTotal : latency;
+    if (summary) {
+        out << "汇总(" << QString::number(span, 'f', 1) << "秒):\n";
+        out << "  连接: 客户端" << clientNum << " 服务端" << serverNum << " 成功" << now.handshakes - prev.handshakes
+            << " 失败" << now.failed - prev.failed << " 断开" << now.disconnects - prev.disconnects << "\n";
+        out << "  握手延迟: " << histogramToString(hs) << "\n";
+        out << "  消息延迟: " << histogramToString(lat) << "\n";
+        out << "  客户端: 发送" << now.sentMessages - prev.sentMessages << "条 " << now.sentBytes - prev.sentBytes << "字节, 应答"
+            << now.acked - prev.acked << "条(" << QString::number((double) (now.acked - prev.acked) / span, 'f', 1) << "/s) "
+            << QString::number((double) (now.ackedBytes - prev.ackedBytes) * 8 / 1000000 / span, 'f', 3) << "Mbit/s"
+            << ", 数据包" << packets << " 重发" << now.retransmits - prev.retransmits << "(" << QString::number(retrans, 'f', 2) << "%)\n";
+        out << "  服务端: 收到" << now.recvMessages - prev.recvMessages << "条(" << QString::number((double) (now.recvMessages - prev.recvMessages) / span, 'f', 1)
+            << "/s) " << QString::number((double) (now.recvBytes - prev.recvBytes) * 8 / 1000000 / span, 'f', 3) << "Mbit/s\n";
+        out << "  资源: RSS " << QString::number((double) rss / 1048576, 'f', 1) << "MB, 每连接" << perConn << "字节, CPU "
+            << QString::number((double) cpu / 10000 / span, 'f', 1) << "%, 每条消息" << perMessage << "us\n";
+    } else {
+        out << QString::number((double) (now.time - first.time) / 1000000, 'f', 1).rightJustified(10)
+            << QString::number(clientNum).rightJustified(9) << QString::number(serverNum).rightJustified(9)
+            << QString::number(now.handshakes - prev.handshakes).rightJustified(7)
+            << QString::number(now.failed - prev.failed).rightJustified(5)
+            << QString::number(now.disconnects - prev.disconnects).rightJustified(5) << " |"
+            << QString::number((double) (now.sentMessages - prev.sentMessages) / span, 'f', 0).rightJustified(8)
+            << QString::number((double) (now.acked - prev.acked) / span, 'f', 0).rightJustified(8)
+            << QString::number((double) (now.ackedBytes - prev.ackedBytes) / 1024 / span, 'f', 1).rightJustified(10)
+            << QString::number((double) (now.recvMessages - prev.recvMessages) / span, 'f', 0).rightJustified(8)
+            << QString::number((double) (now.recvBytes - prev.recvBytes) / 1024 / span, 'f', 1).rightJustified(10)
+            << QString::number(retrans, 'f', 2).rightJustified(6) << " |"
+            << (ms(hs, 50) + "/" + ms(hs, 99)).rightJustified(14) << (ms(lat, 50) + "/" + ms(lat, 99)).rightJustified(15) << " |"
+            << QString::number((double) rss / 1048576, 'f', 1).rightJustified(7) << QString::number(perConn).rightJustified(7)
+            << QString::number((double) cpu / 10000 / span, 'f', 1).rightJustified(7) << perMessage.rightJustified(9) << "\n";
+        last = now;
+        handshake = CFUPHistogram();
+        latency = CFUPHistogram();
+    }
+    out.flush();
+}
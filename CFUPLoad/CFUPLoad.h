@@ -0,0 +1,135 @@
+#pragma once
+
+#include <QHash>
+#include <QHostAddress>
+#include <QMultiMap>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <QTimer>
+#include "CFUP/CFUPAwait.h"
+#include "CFUP/CFUPManager.h"
+
+class CFUPTransport;
+
+//无界面的压力测试和长时间稳定性测试: 服务端在连续的多个端口各运行一个管理器, 客户端的每个管理器连接所有端口
+//客户端按照设定的消息大小和速率发送, 可以周期性地断开一部分连接再重连(连接风暴), 定时输出握手延迟, 吞吐, 重发率, 内存和CPU
+class CFUPLoad final {
+public:
+    explicit CFUPLoad(QTextStream &);
+
+    ~CFUPLoad();
+
+    void setEpoll(bool); // 使用epoll传输层(仅Linux), 每个管理器一个epoll描述符, 嵌入Qt事件循环
+
+    void setPorts(unsigned short, int); // 服务端的起始端口和端口数量, 每个端口一个管理器
+
+    void setConnections(int); // 客户端连接数量
+
+    void setMaxConnections(int); // 服务端每个管理器的最大连接数量
+
+    void setMessageSize(int, int); // 消息大小范围, 均匀分布
+
+    void setRate(double, bool); // 每个连接每秒发送的消息数量, 0表示按窗口发送到饱和; 是否为泊松分布, 否则等间隔
+
+    void setPipeline(int); // 饱和发送时每个连接同时等待应答的消息数量
+
+    void setChurn(double, long long); // 每个间隔(毫秒)断开已连接数量的百分比, 断开后立即重连
+
+    void setInterval(long long); // 报告间隔(毫秒)
+
+    void setSeed(unsigned int); // 消息大小, 发送间隔和断开选择的随机数种子
+
+    QString startServer(const QHostAddress &); // 在指定地址启动服务端, 返回错误信息
+
+    QString startClient(const QHostAddress &); // 连接指定地址的服务端, 返回错误信息
+
+    void report(bool); // 输出这个间隔的一行报告, 参数为true时输出从开始到现在的汇总
+
+private:
+    class Slot { // 客户端的一个连接, 断开后重连仍然使用它
+    public:
+        CFUPManager *m = nullptr;
+        unsigned short port = 0; // 服务端端口
+        CFUP *c = nullptr; // 已连接的CFUP
+        long long connectStart = 0; // 开始连接的时间(微秒), 0表示不在连接中
+    };
+
+    class Counter { // 累计计数, 报告时与上一次的差值就是这个间隔内的数量
+    public:
+        unsigned long long sentMessages = 0; // 客户端提交的消息
+        unsigned long long sentBytes = 0;
+        unsigned long long acked = 0; // 客户端全部应答的消息
+        unsigned long long ackedBytes = 0;
+        unsigned long long packets = 0; // 客户端发送的数据包
+        unsigned long long retransmits = 0;
+        unsigned long long recvMessages = 0; // 服务端收到的消息
+        unsigned long long recvBytes = 0;
+        unsigned long long handshakes = 0; // 客户端连接成功
+        unsigned long long failed = 0; // 客户端连接失败
+        unsigned long long disconnects = 0; // 客户端连接断开(包含主动断开)
+        long long cpu = 0; // 进程CPU时间(微秒)
+        long long time = 0; // 单调时钟(微秒)
+    };
+
+    QTextStream &out;
+    bool epoll = false;
+    unsigned short basePort = 9000;
+    int ports = 1;
+    int connections = 1000;
+    int maxConnections = 65535;
+    int minSize = 1000;
+    int maxSize = 1000;
+    double rate = 10;
+    bool poisson = false;
+    int pipeline = 4;
+    double churn = 0;
+    long long churnInterval = 1000;
+    long long interval = 1000;
+    QRandomGenerator rng{1};
+    QHostAddress serverIP; // 客户端连接的地址
+    QByteArray payload; // 所有消息引用它的前一部分, 不复制
+    QList<CFUPManager *> servers;
+    QList<CFUPManager *> clients;
+    QList<CFUPTransport *> transports; // epoll传输层, 管理器删除之后才删除
+    QList<QObject *> notifiers; // 监听epoll描述符
+    QList<Slot *> slotList;
+    QHash<QPair<CFUPManager *, unsigned short>, Slot *> slotIndex; // (客户端管理器, 服务端端口) -> 连接
+    QMultiMap<long long, Slot *> schedule; // 按速率发送: 下一次发送时间(微秒) -> 连接
+    QTimer sendTimer; // 按速率发送的检查间隔
+    QTimer churnTimer;
+    QTimer reportTimer;
+    Counter total; // 累计计数, 数据包和重发在连接断开时才累计
+    Counter last; // 上一次报告时的计数
+    Counter first; // 开始时的计数
+    CFUPHistogram handshake; // 本间隔的握手延迟(微秒)
+    CFUPHistogram handshakeTotal;
+    CFUPHistogram latency; // 本间隔的消息延迟(微秒), 从提交到全部应答
+    CFUPHistogram latencyTotal;
+    bool running = true; // 结束时不再重连和发送
+    bool begun = false; // 已经开始报告
+    long long baseRss = 0; // 创建管理器之前的常驻内存, 计算每连接内存时扣除
+
+    CFUPManager *newManager_(); // 按照传输层选项创建管理器
+
+    void begin_(); // 记录开始时的计数, 启动报告定时器
+
+    QByteArray message_(); // 按照消息大小分布取一条消息
+
+    long long gap_(); // 下一次发送的间隔(微秒)
+
+    void connect_(Slot *); // 开始连接
+
+    void connected_(Slot *, CFUP *);
+
+    void disconnected_(Slot *);
+
+    void tick_(); // 发送到期的消息
+
+    void churn_(); // 断开一部分连接
+
+    CFUPTask send_(CFUP *, QByteArray); // 发送一条消息, 应答后记录延迟
+
+    CFUPTask pump_(CFUP *); // 饱和发送, 直到断开
+
+    Counter collect_(); // 累计计数加上所有已连接CFUP的计数
+};
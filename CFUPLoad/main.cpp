@@ -0,0 +1,90 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTimer>
+#include "CFUPLoad.h"
+#include "CFUPBench.h"
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("CFUPLoad");
+    QCommandLineParser parser;
+    parser.setApplicationDescription("CFUP压力测试和长时间稳定性测试, 输出握手延迟, 吞吐, 重发率, 每连接内存和每条消息的CPU时间");
+    parser.addHelpOption();
+    QCommandLineOption addressOption({"a", "address"}, "服务端绑定的地址或客户端连接的地址", "address");
+    QCommandLineOption portOption({"p", "port"}, "服务端起始端口", "port", "9000");
+    QCommandLineOption portsOption({"P", "ports"}, "服务端端口数量, 每个端口一个管理器, 客户端每个管理器连接所有端口", "count", "1");
+    QCommandLineOption connectionsOption({"n", "connections"}, "客户端连接数量", "count", "1000");
+    QCommandLineOption maxOption("max", "服务端每个管理器的最大连接数量", "count", "65535");
+    QCommandLineOption sizeOption({"m", "message"}, "消息大小(字节), 最小值-最大值表示均匀分布", "bytes", "1000");
+    QCommandLineOption rateOption({"r", "rate"}, "每个连接每秒发送的消息数量, 0表示按窗口发送到饱和", "count", "10");
+    QCommandLineOption poissonOption("poisson", "发送间隔为泊松分布, 否则等间隔");
+    QCommandLineOption pipelineOption({"k", "pipeline"}, "饱和发送时每个连接同时等待应答的消息数量", "count", "4");
+    QCommandLineOption churnOption({"C", "churn"}, "每个间隔断开已连接数量的百分比, 断开后立即重连", "percent", "0");
+    QCommandLineOption churnIntervalOption("churn-interval", "断开的间隔(毫秒), 间隔长比例高就是连接风暴", "ms", "1000");
+    QCommandLineOption durationOption({"t", "time"}, "运行时长(秒), 0表示一直运行", "seconds", "0");
+    QCommandLineOption intervalOption({"i", "interval"}, "报告间隔(秒)", "seconds", "10");
+    QCommandLineOption seedOption({"s", "seed"}, "随机数种子", "seed", "1");
+    QCommandLineOption backendOption({"B", "backend"}, "传输层: qt或epoll(仅Linux)", "backend", "qt");
+    parser.addOptions({addressOption, portOption, portsOption, connectionsOption, maxOption, sizeOption, rateOption, poissonOption, pipelineOption,
+                       churnOption, churnIntervalOption, durationOption, intervalOption, seedOption, backendOption});
+    parser.addPositionalArgument("mode", "server, client, both(同一进程内的服务端和客户端)或者bench(对比传输层, 使用-B -p -m -k -t)");
+    parser.process(a);
+    auto args = parser.positionalArguments();
+    if (args.size() != 1 || !QStringList({"server", "client", "both", "bench"}).contains(args[0]))parser.showHelp(1);
+    auto mode = args[0];
+    QTextStream out(stdout);
+    auto backend = parser.value(backendOption);
+#ifdef Q_OS_LINUX
+    if (backend != "qt" && backend != "epoll") {
+#else
+    if (backend != "qt") {
+#endif
+        out << "不支持的传输层: " << backend << "\n";
+        return 1;
+    }
+    auto sizes = parser.value(sizeOption).split('-');
+    if (mode == "bench") {
+        CFUPBench bench(out);
+        bench.setEpoll(backend == "epoll");
+        bench.setPort(parser.value(portOption).toUShort());
+        bench.setMessageSize(sizes.first().toInt());
+        bench.setPipeline(parser.value(pipelineOption).toInt());
+        auto duration = parser.value(durationOption).toLongLong();
+        bench.setDuration((duration > 0 ? duration : 10) * 1000);
+        auto error = bench.run();
+        if (error.isEmpty())return 0;
+        out << error << "\n";
+        return 1;
+    }
+    auto load = new CFUPLoad(out);
+    load->setEpoll(backend == "epoll");
+    load->setPorts(parser.value(portOption).toUShort(), parser.value(portsOption).toInt());
+    load->setConnections(parser.value(connectionsOption).toInt());
+    load->setMaxConnections(parser.value(maxOption).toInt());
+    load->setMessageSize(sizes.first().toInt(), sizes.last().toInt());
+    load->setRate(parser.value(rateOption).toDouble(), parser.isSet(poissonOption));
+    load->setPipeline(parser.value(pipelineOption).toInt());
+    load->setChurn(parser.value(churnOption).toDouble(), parser.value(churnIntervalOption).toLongLong());
+    load->setInterval(parser.value(intervalOption).toLongLong() * 1000);
+    load->setSeed(parser.value(seedOption).toUInt());
+    QString address = parser.value(addressOption);
+    if (address.isEmpty())address = mode == "server" ? "0.0.0.0" : "127.0.0.1";
+    QString error;
+    if (mode != "client")error = load->startServer(QHostAddress(address));
+    if (error.isEmpty() && mode != "server")error = load->startClient(QHostAddress(address));
+    if (!error.isEmpty()) {
+        out << error << "\n";
+        delete load;
+        return 1;
+    }
+    auto duration = parser.value(durationOption).toLongLong();
+    if (duration > 0) {
+        QTimer::singleShot(duration * 1000, &a, [load]() {
+            load->report(true);
+            QCoreApplication::quit();
+        });
+    }
+    auto ret = QCoreApplication::exec();
+    delete load; // 在QCoreApplication之前删除管理器
+    return ret;
+}
@@ -0,0 +1,256 @@
+#include "CFUPSim.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEvent>
+#include "tools/tools.h"
+
+CFUPSim::CFUPSim(QTextStream &out) : out(out) {}
+
+void CFUPSim::setConnections(int n) {
+    connections = qBound(1, n, 1000000); // 客户端地址从10.1.0.1开始
+}
+
+void CFUPSim::setSeed(unsigned int s) {
+    seed = s;
+}
+
+void CFUPSim::setDuration(long long d) {
+    duration = d < 1 ? 1 : d;
+}
+
+void CFUPSim::setInterval(long long i) {
+    interval = i < 1 ? 1 : i;
+}
+
+void CFUPSim::setMessageSize(int s) {
+    messageSize = s < 1 ? 1 : s;
+}
+
+void CFUPSim::setPipeline(int p) {
+    pipeline = p < 1 ? 1 : p;
+}
+
+void CFUPSim::setLink(const CFUPSimLink &l) {
+    link = l;
+}
+
+void CFUPSim::setOutage(long long o) {
+    outage = o < 0 ? 0 : o;
+}
+
+void CFUPSim::setConfig(const CFUPConfig &c) {
+    config = c;
+}
+
+void CFUPSim::setIdle(bool i) {
+    idle = i;
+}
+
+void CFUPSim::setCompression(bool c, const QString &k) {
+    compress = c;
+    content = k;
+}
+
+void CFUPSim::setFlood(double f, bool s) {
+    flood = f < 0 ? 0 : f;
+    stateless = s;
+}
+
+CFUPTask CFUPSim::client_(CFUPManager *m, QHostAddress IP) {
+    auto begin = net->now();
+    auto c = co_await m->asyncConnect(IP, 9000);
+    if (!running)co_return;
+    if (c == nullptr) {
+        failed++;
+        co_return;
+    }
+    handshake.record(net->now() - begin);
+    established++;
+    active.insert(c);
+    QObject::connect(c, &CFUP::disconnected, c, [this, c]() { retire_(c); });
+    if (idle)co_return;
+    for (int i = 0; i < pipeline; i++)pump_(c);
+}
+
+CFUPTask CFUPSim::pump_(CFUP *c) {
+    while (running && co_await c->asyncSend(payload)) {}
+}
+
+void CFUPSim::retire_(CFUP *c) {
+    if (!active.remove(c))return;
+    auto s = c->getStats();
+    retired.packetsSent += s.packetsSent;
+    retired.messagesSent += s.messagesSent;
+    retired.retransmits += s.retransmits;
+    if (!running)return; // 结束时关闭的连接不算断开
+    disconnected++;
+    lastDisconnect = net->now();
+}
+
+void CFUPSim::payload_() {
+    QRandomGenerator rng(seed);
+    if (content == "random") {
+        payload.resize(messageSize);
+        for (auto &i: payload)i = (char) rng.bounded(256u);
+    } else if (content == "text") { // 从固定的词表中随机取词, 压缩率与普通文本相近
+        static const char *words[] = {"the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on", "not",
+                                      "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they", "you"};
+        payload.clear();
+        while (payload.size() < messageSize) {
+            payload += words[rng.bounded(30u)];
+            payload += ' ';
+        }
+        payload.truncate(messageSize);
+    } else payload = QByteArray(messageSize, 'x');
+}
+
+void CFUPSim::advance_(long long until) {
+    if (flood <= 0) {
+        net->runUntil(until);
+        return;
+    }
+    while (net->now() < until) { // 每1ms注入一批
+        auto t = qMin(net->now() + 1000, until);
+        floodDebt += flood * (double) (t - net->now()) / 1000000;
+        for (; floodDebt >= 1; floodDebt--)flood_();
+        net->runUntil(t);
+    }
+}
+
+void CFUPSim::flood_() {
+    QHostAddress IP((quint32) (0x64400000 + floodRng.bounded(1u << 22))); // 100.64.0.0/10, 分散在大量网段
+    auto port = (unsigned short) (1024 + floodRng.bounded(64512u));
+    QByteArray data;
+    if (stateless && floodSent % 2 == 1) { // cookie不可能猜中, 但是每个都要计算HMAC
+        data.append((char) 0x62); // NA ACK UD
+        data += dump((unsigned short) 0); // AID
+        data += dumpTLV(TLV_COOKIE, dump((long long) floodRng.generate64()));
+    } else {
+        data.append((char) 0x01); // RC
+        data += dump((unsigned short) 0); // SID
+        data += dump(serverHost->wallMs());
+    }
+    net->inject(IP, port, serverIP, 9000, data);
+    floodSent++;
+}
+
+void CFUPSim::run() {
+    CFUPSimNetwork network(seed);
+    net = &network;
+    net->setLink(link);
+    payload_();
+    running = true;
+    start = net->now();
+    auto rssBefore = rssBytes(); // 创建管理器之前的常驻内存
+    floodRng.seed(seed);
+    serverIP = QHostAddress("10.0.0.1");
+    serverHost = net->addHost(serverIP);
+    auto server = new CFUPManager(serverHost);
+    server->setConfig(config);
+    server->setMaxConnectNum(qMax(connections, 65535));
+    server->setStatelessHandshake(stateless);
+    server->setCompression(compress);
+    server->bind(serverIP.toString(), 9000);
+    QObject::connect(server, &CFUPManager::connected, server, [this](CFUP *c) {
+        c->setReadHandler([this](QByteArrayView data) { // 只计数, 不需要进入可读缓存
+            recvBytes += data.size();
+            recvMessages++;
+        });
+    });
+    QList<CFUPManager *> clients;
+    for (int i = 0; i < connections; i++) {
+        QHostAddress IP((quint32) (0x0A010000 + i + 1));
+        auto m = new CFUPManager(net->addHost(IP));
+        m->setConfig(config);
+        m->setCompression(compress);
+        m->bind(IP.toString(), 0);
+        clients.append(m);
+    }
+    auto rssManagers = rssBytes(); // 管理器本身的内存, 不算入每连接的内存
+    for (auto m: clients)client_(m, serverIP);
+    out << "模拟: 连接" << connections << " 时长" << duration << "ms 种子" << seed << " 消息" << messageSize << "字节 并发" << pipeline
+        << " 延迟" << link.delay << "+0~" << link.jitter << "ms 丢包" << QString::number(link.loss * 100, 'f', 2) << "%"
+        << " 带宽" << (link.rate == 0 ? QString("不限") : QString::number((double) link.rate * 8 / 1000000, 'f', 1) + "Mbit/s") << "\n";
+    if (compress)out << "压缩: zlib, 消息内容" << content << "\n";
+    if (flood > 0)out << "洪水: 每秒" << flood << "个伪造来源的" << (stateless ? "RC和cookie应答, 无状态握手" : "RC") << "\n";
+    out << "时间线(每" << interval << "ms, 已连接 吞吐KB/s 消息/s):\n";
+    unsigned long long lastBytes = 0, lastMessages = 0;
+    QElapsedTimer wall; // 实际耗时, 洪水时用来估计每个伪造数据包的处理开销
+    wall.start();
+    for (long long prev = 0; prev < duration;) {
+        auto t = qMin(prev + interval, duration); // 最后一段可能不足一个间隔
+        if (outage > prev && outage <= t) {
+            advance_(start + outage * 1000);
+            net->setOutage(true);
+        }
+        advance_(start + t * 1000);
+        auto span = (double) (t - prev) / 1000;
+        out << "  " << QString::number(t).rightJustified(8) << QString::number(server->getConnectedNum()).rightJustified(8)
+            << QString::number((double) (recvBytes - lastBytes) / 1024 / span, 'f', 1).rightJustified(12)
+            << QString::number((double) (recvMessages - lastMessages) / span, 'f', 1).rightJustified(10) << "\n";
+        lastBytes = recvBytes;
+        lastMessages = recvMessages;
+        prev = t;
+    }
+    // 先停止发送和关闭管理器, 让等待中的协程全部结束, 再删除管理器
+    running = false;
+    CFUPStats sum = retired;
+    for (auto c: active) {
+        auto s = c->getStats();
+        sum.packetsSent += s.packetsSent;
+        sum.messagesSent += s.messagesSent;
+        sum.retransmits += s.retransmits;
+    }
+    CFUPManagerStats total;
+    for (auto m: clients) {
+        auto s = m->getStats();
+        total.rtt.merge(s.rtt);
+        total.latency.merge(s.latency);
+    }
+    auto netStats = net->getStats();
+    auto admission = server->getAdmissionStats();
+    auto elapsed = wall.nsecsElapsed();
+    auto rssEnd = rssBytes(); // 连接全部存在时的常驻内存
+    auto conn = (long long) server->getConnectedNum();
+    for (auto m: clients)m->close();
+    server->close();
+    net->runUntil(net->now() + 10000);
+    for (auto m: clients)m->quit();
+    server->quit();
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+    auto seconds = (double) duration / 1000;
+    auto rate = sum.packetsSent == 0 ? 0.0 : (double) sum.retransmits * 100 / (double) sum.packetsSent;
+    out << "汇总:\n";
+    out << "  连接: 成功" << established << " 失败" << failed << " 断开" << disconnected;
+    if (disconnected > 0) {
+        out << "(最后一次在" << (lastDisconnect - start) / 1000 << "ms";
+        if (outage > 0)out << ", 断网后" << (lastDisconnect - start) / 1000 - outage << "ms";
+        out << ")";
+    }
+    out << "\n";
+    out << "  有效吞吐: " << QString::number((double) recvBytes * 8 / 1000000 / seconds, 'f', 3) << "Mbit/s 消息" << recvMessages
+        << "(" << QString::number((double) recvMessages / seconds, 'f', 1) << "/s)\n";
+    out << "  握手: " << histogramToString(handshake) << "\n";
+    out << "  消息延迟: " << histogramToString(total.latency) << "\n";
+    out << "  RTT: " << histogramToString(total.rtt) << "\n";
+    out << "  客户端: 数据包" << sum.packetsSent << " 重发" << sum.retransmits << "(" << QString::number(rate, 'f', 2) << "%)"
+        << " 应答的消息" << sum.messagesSent << "\n";
+    out << "  网络: 数据包" << netStats.packets << " 字节" << netStats.bytes << " 到达" << netStats.delivered << " 丢包" << netStats.lost
+        << " 排队丢弃" << netStats.overflow << " 超过MTU" << netStats.tooBig << " 不可达" << netStats.unreachable << "\n";
+    if (recvBytes > 0) { // 压缩节省的带宽; 实际耗时不可复现, 输出到stderr, 与不压缩的结果对比得到压缩的CPU开销
+        out << "  网络字节/消息字节: " << QString::number((double) netStats.bytes / (double) recvBytes, 'f', 3) << "\n";
+        QTextStream(stderr) << "平均每条消息" << QString::number((double) elapsed / 1000 / (double) recvMessages, 'f', 2) << "us\n";
+    }
+    if (flood > 0) {
+        out << "  洪水: 伪造数据包" << floodSent << " 准入通过" << admission.admitted << " 单地址拒绝" << admission.addrRejected
+            << " 网段拒绝" << admission.prefixRejected << " 连接上限拒绝" << admission.fullRejected << "\n";
+        if (floodSent > 0)QTextStream(stderr) << "洪水: 平均每个伪造数据包" << QString::number((double) elapsed / 1000 / (double) floodSent, 'f', 2)
+                                              << "us(包含正常连接的开销)\n";
+    }
+    if (rssEnd > 0) { // 内存不可复现, 单独输出到stderr
+        QTextStream(stderr) << "内存: 每个客户端管理器" << (rssManagers - rssBefore) / connections << "字节, 每连接(客户端+服务端)"
+                            << (conn == 0 ? 0 : (rssEnd - rssManagers) / conn) << "字节, sizeof(CFUP)=" << sizeof(CFUP) << "\n";
+    }
+    active.clear();
+    net = nullptr;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QSet>
+#include <QTextStream>
+#include "CFUP/CFUPAwait.h"
+#include "CFUP/CFUPManager.h"
+#include "CFUP/CFUPSimNetwork.h"
+
+//在模拟网络上运行一个服务端和多个客户端, 每个客户端一个连接, 持续发送固定大小的消息, 输出吞吐, 延迟和断开情况
+//所有时间都是虚拟时间, 相同的参数和种子输出完全相同
+class CFUPSim final {
+public:
+    explicit CFUPSim(QTextStream &);
+
+    void setConnections(int); // 连接数量
+
+    void setSeed(unsigned int); // 随机数种子
+
+    void setDuration(long long); // 模拟时长(毫秒)
+
+    void setInterval(long long); // 时间线间隔(毫秒)
+
+    void setMessageSize(int); // 消息大小
+
+    void setPipeline(int); // 每个连接同时等待应答的消息数量
+
+    void setLink(const CFUPSimLink &); // 链路参数
+
+    void setOutage(long long); // 从该时间(毫秒)开始断网, 0表示不断网, 用于观察心跳和重试耗尽
+
+    void setConfig(const CFUPConfig &); // 连接参数
+
+    void setIdle(bool); // 连接之后不发送消息, 只有心跳, 用于测量每个空闲连接的内存
+
+    void setCompression(bool, const QString &); // 双方开启消息压缩; 消息内容: zero(重复字节), text(随机单词)或random(随机字节)
+
+    void setFlood(double, bool); // 每秒向服务端发送的伪造来源RC数量, 0表示不发送; 服务端是否开启无状态握手(此时一半是伪造cookie的NA ACK)
+
+    void run(); // 运行并输出结果
+
+private:
+    QTextStream &out;
+    int connections = 100;
+    unsigned int seed = 1;
+    long long duration = 10000;
+    long long interval = 1000;
+    int messageSize = 1000;
+    int pipeline = 4;
+    CFUPSimLink link;
+    long long outage = 0;
+    CFUPConfig config;
+    bool idle = false;
+    bool compress = false;
+    QString content = "zero";
+    double flood = 0;
+    bool stateless = false;
+    double floodDebt = 0; // 还没有发送的零头
+    unsigned long long floodSent = 0; // 已经发送的伪造数据包
+    QRandomGenerator floodRng; // 伪造来源和cookie, 与网络的随机数分开, 不影响正常连接的结果
+    QHostAddress serverIP;
+    CFUPSimTransport *serverHost = nullptr;
+    CFUPHistogram handshake; // 客户端握手耗时(虚拟时间, 微秒)
+    bool running = false; // 停止后协程不再发送
+    QByteArray payload; // 所有消息共用
+    long long start = 0; // 开始的虚拟时间(微秒)
+    int established = 0; // 连接成功
+    int failed = 0; // 连接失败
+    int disconnected = 0; // 连接成功后断开
+    long long lastDisconnect = 0; // 最后一次断开的虚拟时间(微秒)
+    unsigned long long recvBytes = 0; // 服务端收到的消息字节数
+    unsigned long long recvMessages = 0; // 服务端收到的消息
+    QSet<CFUP *> active; // 客户端未断开的连接
+    CFUPStats retired; // 客户端已断开连接的统计, 只累计计数
+    CFUPSimNetwork *net = nullptr;
+
+    CFUPTask client_(CFUPManager *, QHostAddress); // 连接服务端, 成功后启动pipeline个发送协程
+
+    CFUPTask pump_(CFUP *); // 发送下一条消息, 直到停止或者断开
+
+    void retire_(CFUP *); // 客户端连接断开, 累计统计
+
+    void payload_(); // 按照消息内容生成所有消息共用的数据
+
+    void advance_(long long); // 运行到指定的虚拟时间(微秒), 期间按速率注入伪造数据包
+
+    void flood_(); // 注入一个伪造来源的RC或者cookie应答
+};
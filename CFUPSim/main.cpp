@@ -0,0 +1,65 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QHashSeed>
+#include "CFUPSim.h"
+
+int main(int argc, char *argv[]) {
+    QHashSeed::setDeterministicGlobalSeed(); // QHash的遍历顺序影响心跳扫描的发送顺序, 固定下来才能复现
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("CFUPSim");
+    QCommandLineParser parser;
+    parser.setApplicationDescription("在虚拟时间的模拟网络上运行CFUP, 输出可复现的吞吐, 延迟和断开情况");
+    parser.addHelpOption();
+    QCommandLineOption connectionsOption({"n", "connections"}, "连接数量", "count", "100");
+    QCommandLineOption seedOption({"s", "seed"}, "随机数种子", "seed", "1");
+    QCommandLineOption durationOption({"t", "time"}, "模拟时长(毫秒)", "ms", "10000");
+    QCommandLineOption intervalOption({"i", "interval"}, "时间线间隔(毫秒)", "ms", "1000");
+    QCommandLineOption sizeOption({"m", "message"}, "消息大小(字节)", "bytes", "1000");
+    QCommandLineOption pipelineOption({"p", "pipeline"}, "每个连接同时等待应答的消息数量", "count", "4");
+    QCommandLineOption delayOption({"d", "delay"}, "单向延迟(毫秒)", "ms", "20");
+    QCommandLineOption jitterOption({"j", "jitter"}, "额外延迟上限(毫秒)", "ms", "0");
+    QCommandLineOption lossOption({"l", "loss"}, "丢包率(%)", "percent", "0");
+    QCommandLineOption rateOption({"b", "bandwidth"}, "每个主机的上行带宽(Mbit/s), 0表示不限制", "mbps", "0");
+    QCommandLineOption queueOption({"q", "queue"}, "上行链路最大排队时间(毫秒)", "ms", "100");
+    QCommandLineOption outageOption({"o", "outage"}, "从该时间(毫秒)开始断网, 0表示不断网", "ms", "0");
+    QCommandLineOption wndOption({"w", "window"}, "窗口大小", "count", "64");
+    QCommandLineOption idleOption("idle", "连接之后不发送消息, 结束时输出每个空闲连接的内存(Linux)");
+    QCommandLineOption compressOption({"z", "compress"}, "双方开启消息压缩");
+    QCommandLineOption contentOption("content", "消息内容: zero(重复字节), text(随机单词)或random(随机字节)", "kind", "zero");
+    QCommandLineOption floodOption("flood", "每秒向服务端发送的伪造来源RC数量", "count", "0");
+    QCommandLineOption statelessOption("stateless", "服务端开启无状态握手, 洪水中一半是伪造cookie的NA ACK");
+    parser.addOptions({connectionsOption, seedOption, durationOption, intervalOption, sizeOption, pipelineOption, delayOption,
+                       jitterOption, lossOption, rateOption, queueOption, outageOption, wndOption, idleOption,
+                       compressOption, contentOption, floodOption, statelessOption});
+    parser.process(a);
+    QTextStream out(stdout);
+    CFUPSim sim(out);
+    sim.setConnections(parser.value(connectionsOption).toInt());
+    sim.setSeed(parser.value(seedOption).toUInt());
+    sim.setDuration(parser.value(durationOption).toLongLong());
+    sim.setInterval(parser.value(intervalOption).toLongLong());
+    sim.setMessageSize(parser.value(sizeOption).toInt());
+    sim.setPipeline(parser.value(pipelineOption).toInt());
+    sim.setIdle(parser.isSet(idleOption));
+    sim.setCompression(parser.isSet(compressOption), parser.value(contentOption));
+    sim.setFlood(parser.value(floodOption).toDouble(), parser.isSet(statelessOption));
+    CFUPSimLink link;
+    link.delay = qMax(0, parser.value(delayOption).toInt());
+    link.jitter = qMax(0, parser.value(jitterOption).toInt());
+    link.loss = qBound(0.0, parser.value(lossOption).toDouble() / 100, 1.0);
+    link.rate = (long long) (parser.value(rateOption).toDouble() * 1000000 / 8);
+    link.queue = qMax(0, parser.value(queueOption).toInt());
+    sim.setLink(link);
+    sim.setOutage(parser.value(outageOption).toLongLong());
+    CFUPConfig config;
+    config.wndSize = parser.value(wndOption).toUInt();
+    sim.setConfig(config);
+    QElapsedTimer timer;
+    timer.start();
+    sim.run();
+    out.flush();
+    auto wall = timer.elapsed(); // 实际耗时不可复现, 单独输出到stderr
+    QTextStream(stderr) << "实际耗时" << wall << "ms\n";
+    return 0;
+}
@@ -12,6 +12,8 @@ CFUPTest::CFUPTest(QWidget *parent) : QWidget(parent), ui(new Ui::CFUPTest) {
     connect(ui->closeConnect, &QPushButton::clicked, this, &CFUPTest::closeConnect);
     connect(ui->newConnect, &QPushButton::clicked, newConnect, &NewConnect::show);
     connect(newConnect, &NewConnect::toConnect, this, &CFUPTest::toConnect);
+    connect(&statsTimer, &QTimer::timeout, this, &CFUPTest::updateStats);
+    statsTimer.start(1000);
 }
 
 CFUPTest::~CFUPTest() {
@@ -82,6 +84,7 @@ void CFUPTest::connected(CFUP *cfup) {
         //Map保存所有客户端(ShowMsg)
         connectList.insert(ipPort, sm);
         connect(cfup, &CFUP::disconnected, this, &CFUPTest::disconnected);
+        connect(cfup, &CFUP::addressChanged, this, &CFUPTest::addressChanged);
     }
     {
         QByteArray IP;
@@ -121,10 +124,44 @@ void CFUPTest::disconnected() {
     }
 }
 
+void CFUPTest::addressChanged() {
+    auto cfup = (CFUP *) sender();
+    auto ipPort = IPPort(cfup->getIP(), cfup->getPort());
+    for (auto i = connectList.begin(); i != connectList.end(); ++i) { // 找到旧地址
+        if (i.value()->getCFUP() != cfup)continue;
+        auto oldIPPort = i.key();
+        auto sm = i.value();
+        connectList.erase(i);
+        connectList.insert(ipPort, sm);
+        sm->setWindowTitle(ipPort);
+        for (auto j = ui->connectList->count() - 1; j >= 0; j--) { // 客户端列表
+            auto item = ui->connectList->item(j);
+            if (item->text() == oldIPPort) {
+                item->setText(ipPort);
+                break;
+            }
+        }
+        break;
+    }
+}
+
 void CFUPTest::appendLog(const QString &data) {
     ui->logger->appendPlainText(data);
 }
 
+void CFUPTest::updateStats() {
+    if (cfupManager == nullptr) {
+        ui->managerStats->clear();
+        return;
+    }
+    auto s = cfupManager->getStats();
+    ui->managerStats->setText(
+            QString("已连接%1 连接中%2 握手成功%3 失败%4\n发送%5包 %6字节 接收%7包 %8字节\nRTT: %9\n消息延迟: %10")
+                    .arg(s.connected).arg(s.connecting).arg(s.handshakeSucceeded).arg(s.handshakeFailed)
+                    .arg(s.packetsSent).arg(s.bytesSent).arg(s.packetsRecv).arg(s.bytesRecv)
+                    .arg(histogramToString(s.rtt), histogramToString(s.latency)));
+}
+
 void CFUPTest::connectFail(const QHostAddress &IP, unsigned short port, const QByteArray &data) {
     newConnect->restoreUI();
     QMessageBox::information(newConnect, IPPort(IP, port) + " 连接失败", data);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QWidget>
+#include <QTimer>
 #include "CFUP/CFUPManager.h"
 #include "ShowMsg/ShowMsg.h"
 #include "NewConnect/NewConnect.h"
@@ -21,13 +22,16 @@ private:
     Ui::CFUPTest *ui{};
     CFUPManager *cfupManager = nullptr;
     NewConnect *newConnect = nullptr;
+    QTimer statsTimer; // 定时刷新管理器统计
     void bind();
     void enableOperateBtn();
     void connected(CFUP *);
     void showMsg();
     void closeConnect();
     void disconnected();
+    void addressChanged();
     void appendLog(const QString &);
+    void updateStats();
     void connectFail(const QHostAddress &, unsigned short, const QByteArray &);
     void toConnect(const QByteArray &, unsigned short);
     QMap<QString, ShowMsg*> connectList;
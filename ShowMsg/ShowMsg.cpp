@@ -12,6 +12,8 @@ ShowMsg::ShowMsg(CFUP *cfup, QWidget *parent) : QWidget(parent), ui(new Ui::Show
     connect(ui->recvIsHex, &QCheckBox::checkStateChanged, this, &ShowMsg::hex);
     connect(ui->sendIsHex, &QCheckBox::checkStateChanged, this, &ShowMsg::hex);
     connect(ui->sendData,&QPlainTextEdit::textChanged,this,&ShowMsg::sendDataChange);
+    connect(&statsTimer, &QTimer::timeout, this, &ShowMsg::updateStats);
+    statsTimer.start(1000);
 }
 
 ShowMsg::~ShowMsg() {
@@ -23,14 +25,15 @@ CFUP *ShowMsg::getCFUP() {
 }
 
 void ShowMsg::recv() {
-    while (cfup->hasData()) {
-        auto data = cfup->nextPendingData();
+    auto msgs = cfup->peekAll(); // 一次取出这一批消息, 不逐条出队
+    for (const auto &data: msgs) {
         recvData.append(data);
         if (ui->recvIsHex->isChecked())
             ui->recvData->appendPlainText(bytesToHexString(data));
         else
             ui->recvData->appendPlainText(data);
     }
+    cfup->consume((qsizetype) msgs.size());
 }
 
 void ShowMsg::send() {
@@ -63,6 +66,18 @@ void ShowMsg::hex(Qt::CheckState state) {
     }
 }
 
+void ShowMsg::updateStats() {
+    if (!isVisible())return;
+    auto s = cfup->getStats();
+    QString text;
+    text += QString("发送: %1包 %2字节 %3条消息 重发%4\n").arg(s.packetsSent).arg(s.bytesSent).arg(s.messagesSent).arg(s.retransmits);
+    text += QString("接收: %1包 %2字节 %3条消息 重复%4 窗口外%5\n").arg(s.packetsRecv).arg(s.bytesRecv).arg(s.messagesRecv).arg(s.duplicates).arg(s.outOfWindow);
+    text += QString("窗口: 发送%1 接收%2 缓存: 1级%3 2级%4 可读%5\n").arg(s.sendWnd).arg(s.recvWnd).arg(s.sendBufLv1).arg(s.sendBufLv2).arg(s.readBuf);
+    text += "RTT: " + histogramToString(s.rtt) + "\n";
+    text += "消息延迟: " + histogramToString(s.latency);
+    ui->stats->setPlainText(text);
+}
+
 void ShowMsg::sendDataChange() {
     const static QRegularExpression regExp(R"(^(([0-9A-Fa-f]{2}\s+)+)?[0-9A-Fa-f]{0,2}$)");
     auto data = ui->sendData->toPlainText();
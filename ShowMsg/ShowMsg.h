@@ -1,5 +1,6 @@
 #pragma once
 #include <QWidget>
+#include <QTimer>
 #include "CFUP/CFUP.h"
 
 QT_BEGIN_NAMESPACE
@@ -20,9 +21,11 @@ private:
     CFUP *cfup = nullptr;
     QString sendLastHexStr;
     QByteArrayList recvData;
+    QTimer statsTimer; // 定时刷新统计
 private slots:
     void recv();
     void send();
     void hex(Qt::CheckState);
     void sendDataChange();
+    void updateStats();
 };
@@ -1,6 +1,17 @@
 #include "tools.h"
+#include <QFile>
 #include <QMutexLocker>
 #include <QHostAddress>
+#include <chrono>
+#include <ctime>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
 
 QString IPPort(const QHostAddress &addr, unsigned short port) {
     QString ip = addr.toString();
@@ -32,6 +43,60 @@ QByteArray dump(long long num) {
     return tmp;
 }
 
+QByteArray dump(unsigned int num) {
+    QByteArray tmp;
+    tmp.resize(4);
+    *(unsigned int *) tmp.data() = num;
+    return tmp;
+}
+
+QByteArray dumpTLV(unsigned char type, const QByteArray &value) {
+    QByteArray tmp;
+    tmp.append((char) type);
+    tmp += dump((unsigned short) value.size());
+    tmp += value;
+    return tmp;
+}
+
+bool parseTLV(const QByteArray &data, QHash<unsigned char, QByteArray> &tlv) {
+    qsizetype i = 0;
+    while (i < data.size()) {
+        if (data.size() - i < 3)return false; // 头部不完整
+        auto type = (unsigned char) data[i];
+        auto len = *(unsigned short *) (data.data() + i + 1);
+        if (data.size() - i - 3 < len)return false; // 长度不正确
+        tlv[type] = data.mid(i + 3, len);
+        i += 3 + len;
+    }
+    return true;
+}
+
+long long steadyUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long long rssBytes() {
+#ifdef Q_OS_LINUX
+    QFile file("/proc/self/statm");
+    if (!file.open(QIODevice::ReadOnly))return 0;
+    auto fields = file.readAll().split(' ');
+    if (fields.size() < 2)return 0;
+    return fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+long long cpuUs() {
+#ifdef Q_OS_UNIX
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return (long long) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#else
+    return (long long) std::clock() * 1000000 / CLOCKS_PER_SEC;
+#endif
+}
+
 QByteArray hexStringToBytes(const QString &str) {
     QByteArray data;
     auto items = str.split(" ", Qt::SkipEmptyParts);
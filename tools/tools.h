@@ -1,8 +1,10 @@
 #pragma once
 
+#include <QHash>
+#include <QByteArray>
+
 class QString;
 class QHostAddress;
-class QByteArray;
 
 QString IPPort(const QHostAddress &, unsigned short);
 
@@ -13,3 +15,15 @@ QByteArray hexStringToBytes(const QString &);
 QByteArray dump(unsigned short);
 
 QByteArray dump(long long);
+
+QByteArray dump(unsigned int);
+
+QByteArray dumpTLV(unsigned char, const QByteArray & = {}); // 握手扩展字段: type(1) + len(2) + value
+
+bool parseTLV(const QByteArray &, QHash<unsigned char, QByteArray> &); // 解析握手扩展字段, 格式不正确返回false
+
+long long steadyUs(); // 单调时钟(微秒), 用于统计耗时
+
+long long rssBytes(); // 进程常驻内存(字节), 不支持的平台为0
+
+long long cpuUs(); // 进程CPU时间(微秒), 包含所有线程